@@ -0,0 +1,278 @@
+#include "bench.h"
+#include "node.h"
+#include "constants.h"
+
+#include <QElapsedTimer>
+#include <QGraphicsScene>
+
+#include <algorithm>
+
+///////////////
+/// Timings ///
+///////////////
+
+/*
+ * Prints count and percentiles (in microseconds) of the samples
+ */
+void Timings::report(QTextStream &out, const QString &label)
+{
+    if (ns.empty())
+    {
+        out << label << "  " << name << "  (no samples)\n";
+        return;
+    }
+
+    QVector<qint64> sorted = ns;
+    std::sort(sorted.begin(), sorted.end());
+
+    auto pct = [&sorted](qreal p) -> qreal {
+        int i = qBound(0, int(p * (sorted.size() - 1)), sorted.size() - 1);
+        return sorted.at(i) / 1000.0;
+    };
+
+    out << label << "  "
+        << name.leftJustified(10)
+        << " n " << qSetFieldWidth(5) << sorted.size() << qSetFieldWidth(0)
+        << "  p50 " << qSetFieldWidth(9) << pct(0.50) << qSetFieldWidth(0)
+        << "  p90 " << qSetFieldWidth(9) << pct(0.90) << qSetFieldWidth(0)
+        << "  p99 " << qSetFieldWidth(9) << pct(0.99) << qSetFieldWidth(0)
+        << "  max " << qSetFieldWidth(9) << pct(1.0) << qSetFieldWidth(0)
+        << "  (us)\n";
+    out.flush();
+}
+
+/*
+ * The p50 sample, in microseconds (0 with no samples)
+ */
+qreal Timings::median() const
+{
+    if (ns.empty())
+        return 0;
+
+    QVector<qint64> sorted = ns;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted.at((sorted.size() - 1) / 2) / 1000.0;
+}
+
+/////////////
+/// Bench ///
+/////////////
+
+Bench::Bench(Canvas& c, QRectF r, quint32 seed) :
+    canvas(c),
+    content(r),
+    rng(seed)
+{
+}
+
+/*
+ * Inserting a statement with prediction at a random spot inside a random cut
+ * (or the top level), same as pressing a letter key with the mouse there
+ */
+Timings Bench::add(int samples)
+{
+    Timings t;
+    t.name = "add";
+    QElapsedTimer timer;
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QList<Node*> cuts = collect(true, false);
+        cuts.append(canvas.getRoot());
+        Node* par = pick(cuts);
+
+        QPointF pt = par->isRoot() ? pointIn(content)
+                                   : pointIn(par->getSceneDraw());
+
+        timer.start();
+        Node* n = par->addChildStatement(pt, "B");
+        t.ns.append(timer.nsecsElapsed());
+
+        if (n != nullptr && par->isRoot())
+            canvas.addNodeToScene(n);
+    }
+
+    return t;
+}
+
+/*
+ * A single step of a drag: try the four neighbouring grid positions in turn
+ * until one doesn't collide (like the bloom in Node::mouseMoveEvent)
+ */
+Timings Bench::dragStep(int samples)
+{
+    Timings t;
+    t.name = "drag step";
+    QElapsedTimer timer;
+
+    const QList<QPointF> deltas = { QPointF(GRID_SPACING, 0),
+                                    QPointF(0, GRID_SPACING),
+                                    QPointF(-GRID_SPACING, 0),
+                                    QPointF(0, -GRID_SPACING) };
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QList<Node*> nodes = collect(true, true);
+        if (nodes.empty())
+            break;
+
+        QList<Node*> sel;
+        sel.append(pick(nodes));
+
+        timer.start();
+        int found = Node::firstValidDelta(sel, deltas);
+        if (found >= 0)
+            sel.first()->moveBy(deltas.at(found).x(), deltas.at(found).y());
+        t.ns.append(timer.nsecsElapsed());
+    }
+
+    return t;
+}
+
+/*
+ * Surrounding up to four siblings with a new cut
+ */
+Timings Bench::surround(int samples)
+{
+    Timings t;
+    t.name = "surround";
+    QElapsedTimer timer;
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QList<Node*> cuts = collect(true, false);
+        cuts.append(canvas.getRoot());
+        Node* par = pick(cuts);
+        QList<Node*> kids = par->getChildren();
+        if (kids.empty())
+            continue;
+
+        canvas.clearSelection();
+        std::shuffle(kids.begin(), kids.end(), rng);
+        for (int k = 0; k < qMin(4, kids.size()); ++k)
+            canvas.selectNode(kids.at(k));
+
+        canvas.lastMousePos = kids.first()->getSceneDraw().topLeft();
+
+        timer.start();
+        canvas.surroundNodesWithCut();
+        t.ns.append(timer.nsecsElapsed());
+    }
+
+    return t;
+}
+
+/*
+ * Deleting a single statement
+ */
+Timings Bench::remove(int samples)
+{
+    Timings t;
+    t.name = "delete";
+    QElapsedTimer timer;
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QList<Node*> statements = collect(false, true);
+        if (statements.empty())
+            break;
+
+        canvas.clearSelection();
+        canvas.selectNode(pick(statements));
+
+        timer.start();
+        canvas.deleteSelection();
+        t.ns.append(timer.nsecsElapsed());
+    }
+
+    return t;
+}
+
+/*
+ * Shift + drag box selection over a random area of the content
+ */
+Timings Bench::boxSelect(int samples)
+{
+    Timings t;
+    t.name = "box select";
+    QElapsedTimer timer;
+
+    std::uniform_real_distribution<qreal> size(4 * GRID_SPACING, 40 * GRID_SPACING);
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QRectF box(pointIn(content), QSizeF(size(rng), size(rng)));
+
+        timer.start();
+        Node::setSelectionFromBox(canvas.getRoot(), box);
+        t.ns.append(timer.nsecsElapsed());
+
+        canvas.clearSelection();
+    }
+
+    return t;
+}
+
+/*
+ * The lookup a hover needs under the canvas' current index mode: Qt's item
+ * query at the mouse for the Qt indexes, or the node tree walk for nested mode
+ */
+Timings Bench::hover(int samples)
+{
+    Timings t;
+    t.name = "hover";
+    QElapsedTimer timer;
+
+    QGraphicsScene* scene = canvas.getScene();
+    Node* root = canvas.getRoot();
+    bool nested = (canvas.getIndexMode() == Canvas::NestedIndexMode);
+
+    // First query builds the BSP tree, which isn't what we're measuring
+    scene->items(content.center());
+
+    for (int i = 0; i < samples; ++i)
+    {
+        QPointF pt = pointIn(content);
+
+        timer.start();
+        if (nested)
+            Node::nodeAt(root, pt);
+        else
+            scene->items(pt, Qt::IntersectsItemShape, Qt::DescendingOrder);
+        t.ns.append(timer.nsecsElapsed());
+    }
+
+    return t;
+}
+
+/*
+ * All cuts and/or statements currently on the canvas
+ */
+QList<Node*> Bench::collect(bool cuts, bool statements) const
+{
+    QList<Node*> found;
+    QList<Node*> stack = canvas.getRoot()->children;
+
+    while (!stack.empty())
+    {
+        Node* n = stack.takeLast();
+        if ((cuts && n->isCut()) || (statements && n->isStatement()))
+            found.append(n);
+        stack.append(n->children);
+    }
+
+    return found;
+}
+
+Node* Bench::pick(const QList<Node*> &nodes)
+{
+    std::uniform_int_distribution<int> i(0, nodes.size() - 1);
+    return nodes.at(i(rng));
+}
+
+QPointF Bench::pointIn(const QRectF &r)
+{
+    std::uniform_real_distribution<qreal> x(r.left(), r.right());
+    std::uniform_real_distribution<qreal> y(r.top(), r.bottom());
+    return QPointF(x(rng), y(rng));
+}
@@ -0,0 +1,54 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "canvas.h"
+
+#include <QList>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+
+#include <random>
+
+class Node;
+
+/*
+ * Latency samples (in nanoseconds) for a single operation
+ */
+struct Timings
+{
+    QString name;
+    QVector<qint64> ns;
+
+    void report(QTextStream &out, const QString &label);
+    qreal median() const;
+};
+
+/*
+ * Drives the engine's operations directly against a canvas that's never
+ * shown, timing each call. Friend of Node and Canvas, so it can reach the
+ * same internals the mouse and keyboard handlers use.
+ */
+class Bench
+{
+public:
+    Bench(Canvas& c, QRectF content, quint32 seed = 1234);
+
+    Timings add(int samples);
+    Timings dragStep(int samples);
+    Timings surround(int samples);
+    Timings remove(int samples);
+    Timings boxSelect(int samples);
+    Timings hover(int samples);
+
+private:
+    Canvas& canvas;
+    QRectF content;
+    std::mt19937 rng;
+
+    QList<Node*> collect(bool cuts, bool statements) const;
+    Node* pick(const QList<Node*> &nodes);
+    QPointF pointIn(const QRectF &r);
+};
+
+#endif // BENCH_H
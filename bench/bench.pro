@@ -0,0 +1,55 @@
+#-------------------------------------------------
+#
+# Headless benchmarks for the layout and collision engine. Builds the
+# engine sources from the parent directory against an offscreen scene.
+#
+#   mkdir build-bench && cd build-bench
+#   qmake ../bench/bench.pro && make && ./egg-bench [node counts...]
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
+
+TARGET = egg-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# Unlike the app, debug logging is left compiled in (but switched off at
+# runtime), so the logging overhead section has something to compare
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        main.cpp \
+    bench.cpp \
+    generators.cpp \
+    ../node.cpp \
+    ../canvas.cpp \
+    ../colorpalette.cpp \
+    ../spatialindex.cpp \
+    ../logging.cpp \
+    ../document.cpp \
+    ../layout.cpp \
+    ../nodepool.cpp \
+    ../symboltable.cpp \
+    ../graphmodel.cpp
+
+HEADERS += \
+    bench.h \
+    generators.h \
+    ../node.h \
+    ../canvas.h \
+    ../colorpalette.h \
+    ../constants.h \
+    ../spatialindex.h \
+    ../logging.h \
+    ../document.h \
+    ../layout.h \
+    ../nodepool.h \
+    ../symboltable.h \
+    ../graphmodel.h
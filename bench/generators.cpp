@@ -0,0 +1,222 @@
+#include "generators.h"
+#include "canvas.h"
+#include "node.h"
+#include "constants.h"
+
+#include <QVector>
+#include <QtCore/QtMath>
+
+#include <random>
+
+// Nodes per row inside a cut before wrapping to the next row
+#define ROW_LENGTH 12
+
+// How deep the chains of the deep graph go
+#define CHAIN_DEPTH 24
+
+namespace {
+
+/*
+ * A graph before it has been put on a canvas. Sizes are filled in by measure()
+ * so that children can be placed without any collision checks.
+ */
+struct Shape
+{
+    bool cut;
+    QVector<Shape> kids;
+    qreal w, h;
+
+    // Offsets of each kid's top left from my top left
+    QVector<QPointF> offsets;
+};
+
+Shape statement()
+{
+    Shape s;
+    s.cut = false;
+    s.w = s.h = 0;
+    return s;
+}
+
+Shape cut()
+{
+    Shape s;
+    s.cut = true;
+    s.w = s.h = 0;
+    return s;
+}
+
+int countNodes(const Shape &s)
+{
+    int count = 1;
+    for (const Shape &k : s.kids)
+        count += countNodes(k);
+    return count;
+}
+
+/*
+ * Places kids in rows of ROW_LENGTH, GRID_SPACING apart, starting at (x, y).
+ * Returns the size of the block.
+ */
+QSizeF placeRows(QVector<Shape> &kids, QVector<QPointF> &offsets, qreal x, qreal y)
+{
+    qreal rowX = x, rowY = y, rowH = 0, maxX = x;
+    offsets.clear();
+
+    for (int i = 0; i < kids.size(); ++i)
+    {
+        if (i > 0 && i % ROW_LENGTH == 0)
+        {
+            rowX = x;
+            rowY += rowH + GRID_SPACING;
+            rowH = 0;
+        }
+
+        offsets.append(QPointF(rowX, rowY));
+        rowX += kids[i].w + GRID_SPACING;
+        rowH = qMax(rowH, kids[i].h);
+        maxX = qMax(maxX, rowX - GRID_SPACING);
+    }
+
+    return QSizeF(maxX - x, rowY + rowH - y);
+}
+
+void measure(Shape &s)
+{
+    if (!s.cut)
+    {
+        s.w = s.h = STATEMENT_SIZE;
+        return;
+    }
+
+    if (s.kids.empty())
+    {
+        s.w = s.h = EMPTY_CUT_SIZE;
+        return;
+    }
+
+    for (Shape &k : s.kids)
+        measure(k);
+
+    QSizeF block = placeRows(s.kids, s.offsets, GRID_SPACING, GRID_SPACING);
+    s.w = block.width() + 2 * GRID_SPACING;
+    s.h = block.height() + 2 * GRID_SPACING;
+}
+
+Node* instantiate(const Shape &s, Node* parent, QPointF tl)
+{
+    if (!s.cut)
+        return parent->addChildStatement(tl, "A", false);
+
+    Node* n = parent->addChildCut(tl, false);
+    for (int i = 0; i < s.kids.size(); ++i)
+        instantiate(s.kids[i], n, tl + s.offsets[i]);
+    return n;
+}
+
+Shape deepChain(int depth)
+{
+    Shape c = cut();
+    c.kids.append(statement());
+    c.kids.append(statement());
+    if (depth > 1)
+        c.kids.append(deepChain(depth - 1));
+    return c;
+}
+
+Shape randomTree(std::mt19937 &rng, int depth)
+{
+    std::uniform_int_distribution<int> statements(0, 6);
+    std::uniform_int_distribution<int> cuts(0, depth > 0 ? 3 : 0);
+
+    Shape c = cut();
+    int s = statements(rng);
+    for (int i = 0; i < s; ++i)
+        c.kids.append(statement());
+
+    int k = cuts(rng);
+    for (int i = 0; i < k; ++i)
+        c.kids.append(randomTree(rng, depth - 1));
+
+    return c;
+}
+
+} // namespace
+
+QString shapeName(GraphShape shape)
+{
+    switch (shape)
+    {
+    case WideGraph: return "wide";
+    case DeepGraph: return "deep";
+    case MixedGraph: return "mixed";
+    }
+    return "?";
+}
+
+QRectF generateGraph(Canvas& canvas, GraphShape shape, int n, quint32 seed)
+{
+    std::mt19937 rng(seed);
+    QVector<Shape> top;
+    int count = 0;
+
+    switch (shape)
+    {
+    case WideGraph:
+      {
+        Shape c = cut();
+        for (int i = 1; i < n; ++i)
+            c.kids.append(statement());
+        top.append(c);
+        count = n;
+      }
+      break;
+    case DeepGraph:
+        while (count < n)
+        {
+            top.append(deepChain(CHAIN_DEPTH));
+            count += countNodes(top.last());
+        }
+        break;
+    case MixedGraph:
+        while (count < n)
+        {
+            top.append(randomTree(rng, 5));
+            count += countNodes(top.last());
+        }
+        break;
+    }
+
+    // Lay out the top level like any other cut's contents (wide graphs have
+    // one huge cut, so the wrapping only matters for the other shapes)
+    for (Shape &s : top)
+        measure(s);
+
+    QVector<QPointF> offsets;
+    QSizeF size = placeRows(top, offsets, GRID_SPACING, GRID_SPACING);
+
+    if (shape == WideGraph && !top.first().kids.empty())
+    {
+        // Square-ish block instead of a single very long row
+        Shape &c = top.first();
+        int cols = qMax(1, qCeil(qSqrt(qreal(c.kids.size()))));
+        c.offsets.clear();
+        for (int i = 0; i < c.kids.size(); ++i)
+            c.offsets.append(QPointF(GRID_SPACING + (i % cols) * 3 * GRID_SPACING,
+                                     GRID_SPACING + (i / cols) * 3 * GRID_SPACING));
+        int rows = (c.kids.size() + cols - 1) / cols;
+        c.w = 2 * GRID_SPACING + cols * 3 * GRID_SPACING - GRID_SPACING;
+        c.h = 2 * GRID_SPACING + rows * 3 * GRID_SPACING - GRID_SPACING;
+        size = QSizeF(c.w, c.h);
+    }
+
+    Node* root = canvas.getRoot();
+    canvas.beginEdit();
+    for (int i = 0; i < top.size(); ++i)
+        canvas.addNodeToScene(instantiate(top[i], root, offsets[i]));
+    canvas.commitEdit();
+
+    return QRectF(0, 0,
+                  size.width() + 2 * GRID_SPACING,
+                  size.height() + 2 * GRID_SPACING);
+}
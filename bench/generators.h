@@ -0,0 +1,28 @@
+#ifndef GENERATORS_H
+#define GENERATORS_H
+
+#include <QRectF>
+#include <QString>
+
+class Canvas;
+
+/*
+ * Synthetic existential graphs for the benchmarks. Each generator fills an
+ * (empty) canvas with roughly n nodes, laid out without any overlap, and
+ * returns the scene rect covering all of the content.
+ *
+ *   wide  - a single cut holding every statement side by side
+ *   deep  - many chains of nested cuts, each level with a couple statements
+ *   mixed - random trees of cuts and statements of varying width and depth
+ */
+enum GraphShape
+{
+    WideGraph,
+    DeepGraph,
+    MixedGraph
+};
+
+QString shapeName(GraphShape shape);
+QRectF generateGraph(Canvas& canvas, GraphShape shape, int n, quint32 seed = 1234);
+
+#endif // GENERATORS_H
@@ -0,0 +1,249 @@
+#include "bench.h"
+#include "generators.h"
+#include "canvas.h"
+#include "document.h"
+#include "layout.h"
+#include "node.h"
+
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QGraphicsScene>
+#include <QLoggingCategory>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+/*
+ * Headless benchmark driver for the layout and collision engine. Runs every
+ * operation against each synthetic graph shape and prints latency percentiles,
+ * then compares hover lookups across the scene index modes.
+ *
+ * Usage: egg-bench [node counts...]   (defaults to 1000 10000)
+ *
+ * QT_QPA_PLATFORM is set to offscreen unless given, so no display is needed.
+ */
+
+#define OP_SAMPLES 200
+#define HOVER_SAMPLES 2000
+#define IO_SAMPLES 10
+
+static QTextStream out(stdout);
+
+// With logging switched on, messages are still formatted but never written
+// out, so the overhead section measures the cost inside the engine only
+static void dropDebugOutput(QtMsgType type, const QMessageLogContext &, const QString &msg)
+{
+    if (type == QtDebugMsg)
+        return;
+    QTextStream(stderr) << msg << "\n";
+}
+
+static QString modeName(Canvas::IndexMode mode)
+{
+    switch (mode)
+    {
+    case Canvas::NoIndexMode: return "none";
+    case Canvas::BspIndexMode: return "bsp";
+    case Canvas::NestedIndexMode: return "nested";
+    }
+    return "?";
+}
+
+/*
+ * Every operation, each against a freshly generated graph so earlier
+ * operations can't skew the later ones
+ */
+static void benchOperations(GraphShape shape, int n)
+{
+    QString label = QString("%1 %2").arg(shapeName(shape), 5).arg(n, 6);
+
+    for (int op = 0; op < 5; ++op)
+    {
+        Canvas canvas;
+        QRectF content = generateGraph(canvas, shape, n);
+        Bench bench(canvas, content);
+
+        Timings t;
+        switch (op)
+        {
+        case 0: t = bench.add(OP_SAMPLES); break;
+        case 1: t = bench.dragStep(OP_SAMPLES); break;
+        case 2: t = bench.surround(OP_SAMPLES); break;
+        case 3: t = bench.remove(OP_SAMPLES); break;
+        case 4: t = bench.boxSelect(OP_SAMPLES); break;
+        }
+        t.report(out, label);
+    }
+}
+
+/*
+ * Add and drag with every egg.* debug category switched on versus off, then
+ * how many times faster each is with it off (by p50). Release builds of the
+ * app compile the logging out, which is at least as fast as off.
+ */
+static void benchLogging(int n)
+{
+    Timings add[2], drag[2]; // [0] on, [1] off
+
+    for (int off = 0; off < 2; ++off)
+    {
+        QLoggingCategory::setFilterRules(off ? "egg.*.debug=false"
+                                             : "egg.*.debug=true");
+        QString label = QString("log %1 %2").arg(off ? "off" : "on", 3).arg(n, 6);
+
+        Canvas addCanvas;
+        Bench addBench(addCanvas, generateGraph(addCanvas, MixedGraph, n));
+        add[off] = addBench.add(OP_SAMPLES);
+        add[off].report(out, label);
+
+        Canvas dragCanvas;
+        Bench dragBench(dragCanvas, generateGraph(dragCanvas, MixedGraph, n));
+        drag[off] = dragBench.dragStep(OP_SAMPLES);
+        drag[off].report(out, label);
+    }
+
+    QLoggingCategory::setFilterRules(QString());
+
+    auto speedup = [](const Timings &on, const Timings &off) -> qreal {
+        return off.median() > 0 ? on.median() / off.median() : 0;
+    };
+    out << "log speedup " << QString::number(n).rightJustified(6)
+        << "  add " << QString::number(speedup(add[0], add[1]), 'f', 2) << "x"
+        << "  drag " << QString::number(speedup(drag[0], drag[1]), 'f', 2) << "x"
+        << "  (p50, on / off)\n";
+    out.flush();
+}
+
+static void benchHover(int n, Canvas::IndexMode mode)
+{
+    Canvas canvas;
+    QRectF content = generateGraph(canvas, MixedGraph, n);
+
+    canvas.getScene()->setSceneRect(content);
+    canvas.setIndexMode(mode);
+
+    Bench bench(canvas, content);
+    bench.hover(HOVER_SAMPLES)
+         .report(out, QString("%1 %2").arg(modeName(mode), 6).arg(n, 6));
+}
+
+/*
+ * Gives views to every top level record that doesn't have one yet, so the
+ * canvas ends up fully built as if it had no viewport culling
+ */
+static void hydrateAll(Canvas &canvas)
+{
+    GraphModel &model = canvas.getModel();
+    for (int c = model.firstChild(GraphModel::RootId); c != GraphModel::NoId;
+         c = model.nextSibling(c))
+    {
+        if (model.view(c) == nullptr)
+            canvas.getScene()->addItem(canvas.getRoot()->hydrateChild(c));
+    }
+}
+
+/*
+ * Saving and loading a document, each sample a full round trip through disk.
+ * "load" builds every node, like loads did before viewport culling, so it
+ * stays comparable with older runs; "load model" is Document::load alone,
+ * which only fills the model and builds what's near the (never shown)
+ * viewport.
+ */
+static void benchDocument(int n)
+{
+    QTemporaryDir dir;
+    QString path = dir.filePath("bench.egg");
+    QString label = QString("%1 %2").arg(shapeName(MixedGraph), 5).arg(n, 6);
+
+    Canvas canvas;
+    generateGraph(canvas, MixedGraph, n);
+
+    Timings save, load, loadModel;
+    save.name = "save";
+    load.name = "load";
+    loadModel.name = "load model";
+    QElapsedTimer timer;
+
+    for (int i = 0; i < IO_SAMPLES; ++i)
+    {
+        timer.start();
+        Document::save(&canvas, path);
+        save.ns.append(timer.nsecsElapsed());
+
+        timer.start();
+        Document::load(&canvas, path);
+        qint64 model = timer.nsecsElapsed();
+        hydrateAll(canvas);
+        loadModel.ns.append(model);
+        load.ns.append(timer.nsecsElapsed());
+    }
+
+    save.report(out, label);
+    load.report(out, label);
+    loadModel.report(out, label);
+}
+
+/*
+ * A full bulk layout pass over the whole graph
+ */
+static void benchLayout(GraphShape shape, int n)
+{
+    Canvas canvas;
+    generateGraph(canvas, shape, n);
+
+    Timings t;
+    t.name = "arrange";
+    QElapsedTimer timer;
+
+    for (int i = 0; i < IO_SAMPLES; ++i)
+    {
+        timer.start();
+        Layout::arrange(&canvas);
+        t.ns.append(timer.nsecsElapsed());
+    }
+
+    t.report(out, QString("%1 %2").arg(shapeName(shape), 5).arg(n, 6));
+}
+
+int main(int argc, char* argv[])
+{
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+    qInstallMessageHandler(dropDebugOutput);
+
+    QList<int> sizes;
+    for (const QString &arg : app.arguments().mid(1))
+        sizes.append(arg.toInt());
+    if (sizes.empty())
+        sizes = { 1000, 10000 };
+
+    out << "== operations ==\n";
+    for (int n : sizes)
+        for (GraphShape shape : { WideGraph, DeepGraph, MixedGraph })
+            benchOperations(shape, n);
+
+    out << "\n== logging overhead ==\n";
+    benchLogging(sizes.first());
+
+    out << "\n== bulk layout ==\n";
+    for (int n : sizes)
+        for (GraphShape shape : { WideGraph, DeepGraph, MixedGraph })
+            benchLayout(shape, n);
+
+    out << "\n== document io ==\n";
+    for (int n : sizes)
+        benchDocument(n);
+    benchDocument(50000);
+
+    out << "\n== hover lookup ==\n";
+    for (int n : { 1000, 10000, 50000 })
+        for (Canvas::IndexMode mode : { Canvas::NoIndexMode,
+                                        Canvas::BspIndexMode,
+                                        Canvas::NestedIndexMode })
+            benchHover(n, mode);
+
+    out.flush();
+    return 0;
+}
@@ -1,8 +1,17 @@
 #include "canvas.h"
 #include "node.h"
 #include <QKeyEvent>
-#include <QDebug>
+#include "logging.h"
+#include "layout.h"
 #include <QScrollBar>
+#include <QScreen>
+#include <QGuiApplication>
+#include <QTimer>
+#include <QPainter>
+#include <QPixmapCache>
+#include <QStyleOptionGraphicsItem>
+#include <QMap>
+#include <QtCore/QtMath>
 #include "constants.h"
 #include "colorpalette.h"
 
@@ -10,18 +19,25 @@ class MainWindow;
 
 Canvas::Canvas(QWidget* parent) :
     QGraphicsView(parent),
+    pool(sizeof(Node)),
     mouseShiftPress(false),
     noMouseMovement(false),
     setHighlightByKeyboard(false),
+    editDepth(0),
+    indexMode(BspIndexMode),
+    dragNode(nullptr),
+    dragPending(false),
+    showGrid(false),
     showBounds(false)
 {
     scene = new QGraphicsScene(this);
-    scene->setItemIndexMethod(QGraphicsScene::NoIndex);
     //scene->setSceneRect(-200, -200, 400, 400);
-    scene->setSceneRect(0,0,10000,10000);
+    // Left unset until the first viewport sync, once the widget has its real
+    // size, sizes it to the content (see fitSceneRect)
     setScene(scene);
 
-    setCacheMode(CacheBackground);
+    // The background caches itself in tiles (see drawBackground)
+    setCacheMode(CacheNone);
     setRenderHint(QPainter::Antialiasing);
     setTransformationAnchor(AnchorUnderMouse);
     setMinimumSize(400, 400);
@@ -37,30 +53,144 @@ Canvas::Canvas(QWidget* parent) :
     // Scroll bars (debug testing)
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
     setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+
+    setIndexMode(indexMode);
+
+    // One drag solve per display frame
+    qreal hz = 60;
+    if (QGuiApplication::primaryScreen() != nullptr &&
+            QGuiApplication::primaryScreen()->refreshRate() > 0)
+        hz = QGuiApplication::primaryScreen()->refreshRate();
+
+    dragTimer = new QTimer(this);
+    dragTimer->setSingleShot(true);
+    dragTimer->setTimerType(Qt::PreciseTimer);
+    dragTimer->setInterval(qMax(1, qRound(1000 / hz)));
+    connect(dragTimer, SIGNAL(timeout()), this, SLOT(dragFrame()));
+
+    // Views follow the viewport once the event queue is clear, so a burst of
+    // pans or zooms only syncs once
+    viewportTimer = new QTimer(this);
+    viewportTimer->setSingleShot(true);
+    viewportTimer->setInterval(0);
+    connect(viewportTimer, SIGNAL(timeout()), this, SLOT(syncViewport()));
 }
 
-void Canvas::drawBackground(QPainter* painter, const QRectF &rect)
+Canvas::~Canvas()
 {
-    Q_UNUSED(painter)
-    Q_UNUSED(rect)
-    QRectF sceneRect = this->sceneRect();
+    // Nodes call back into the canvas while they're destroyed, so they have
+    // to go while our members are still alive. Deleting the root first takes
+    // the whole tree down in one sweep, rather than having the scene delete
+    // top level nodes one at a time.
+    delete root;
+    delete scene;
+}
 
+/*
+ * Fills the exposed rect with the canvas color and, if it's on, the grid.
+ *
+ * Every grid tile looks the same (tiles start on grid lines), so a tile is
+ * rasterized once per zoom level, pixel ratio and theme and then just copied
+ * to each tile position. Tiles are placed in device pixels, unscaled, with
+ * each one's origin snapped to a whole pixel from its exact position, so
+ * lines stay one crisp pixel and the snapping never adds up across tiles.
+ * Scrolling moves what's already on screen, so panning only ever paints the
+ * newly exposed strip, from that one cached tile.
+ */
+void Canvas::drawBackground(QPainter* painter, const QRectF &rect)
+{
     //QLinearGradient gradient(sceneRect.topLeft(),
                              //sceneRect.bottomRight());
     //gradient.setColorAt(0, Qt::white);
     //gradient.setColorAt(1, QColor(Qt::lightGray).lighter(150));
 
-    painter->fillRect(rect.intersected(sceneRect), ColorPalette::canvasColor());
+    painter->fillRect(rect, ColorPalette::canvasColor());
+    if (!showGrid)
+        return;
+
+    const QTransform t = painter->worldTransform();
+    qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(t);
+    qreal size = BACKGROUND_TILE * lod; // in device independent pixels
+
+    // Lines this close together would just read as a tint
+    if (GRID_SPACING * lod < BACKGROUND_GRID_MIN_PX)
+        return;
+
+    if (t.isRotating() || size < BACKGROUND_TILE_MIN_PX || size > BACKGROUND_TILE_MAX_PX)
+    {
+        paintGrid(painter, rect);
+        return;
+    }
+
+    qreal dpr = painter->device()->devicePixelRatioF();
+
+    QString key = QString("egg-grid-%1-%2-%3")
+            .arg(lod, 0, 'g', 8)
+            .arg(dpr)
+            .arg(ColorPalette::gridPen().color().rgba());
+
+    QPixmap tile;
+    if (!QPixmapCache::find(key, &tile))
+    {
+        int devPx = qCeil(size * dpr);
+        tile = QPixmap(devPx, devPx);
+        tile.setDevicePixelRatio(dpr);
+        tile.fill(Qt::transparent);
+
+        // Each line through the middle of the device pixel its exact
+        // position rounds to
+        QPainter p(&tile);
+        p.setPen(ColorPalette::gridPen());
+        qreal end = devPx / dpr;
+        for (int k = 0; k < BACKGROUND_TILE / GRID_SPACING; ++k)
+        {
+            qreal at = (qRound(k * GRID_SPACING * lod * dpr) + 0.5) / dpr;
+            p.drawLine(QPointF(at, 0), QPointF(at, end));
+            p.drawLine(QPointF(0, at), QPointF(end, at));
+        }
+        p.end();
+
+        QPixmapCache::insert(key, tile);
+    }
 
-    painter->setBrush(Qt::NoBrush);
-    painter->drawRect(sceneRect);
+    int x1 = qFloor(rect.left() / BACKGROUND_TILE);
+    int y1 = qFloor(rect.top() / BACKGROUND_TILE);
+    int x2 = qFloor(rect.right() / BACKGROUND_TILE);
+    int y2 = qFloor(rect.bottom() / BACKGROUND_TILE);
+
+    painter->save();
+    painter->resetTransform();
+    for (int ty = y1; ty <= y2; ++ty)
+        for (int tx = x1; tx <= x2; ++tx)
+        {
+            QPointF at = t.map(QPointF(tx * BACKGROUND_TILE, ty * BACKGROUND_TILE));
+            painter->drawPixmap(QPointF(qRound(at.x() * dpr) / dpr,
+                                        qRound(at.y() * dpr) / dpr),
+                                tile);
+        }
+    painter->restore();
+}
+
+/*
+ * Draws the grid lines inside rect straight onto painter, in scene coords.
+ * Used when the view is rotated or tiles would be too small or too big.
+ */
+void Canvas::paintGrid(QPainter* painter, const QRectF &rect)
+{
+    painter->setPen(ColorPalette::gridPen());
+
+    qreal g = GRID_SPACING;
+    for (qreal x = qCeil(rect.left() / g) * g; x < rect.right(); x += g)
+        painter->drawLine(QPointF(x, rect.top()), QPointF(x, rect.bottom()));
+    for (qreal y = qCeil(rect.top() / g) * g; y < rect.bottom(); y += g)
+        painter->drawLine(QPointF(rect.left(), y), QPointF(rect.right(), y));
 }
 
 void Canvas::keyPressEvent(QKeyEvent* event)
 {
     QGraphicsView::keyPressEvent(event);
     QString key = event->text();
-    qDebug() << "key pressed" << key;
+    qCDebug(lcInput) << "key pressed" << key;
 
     if ((event->modifiers() & Qt::ShiftModifier) ||
         (event->text().length() > 0 && event->text().at(0).isUpper()))
@@ -71,7 +201,7 @@ void Canvas::keyPressEvent(QKeyEvent* event)
           addCut();
           break;
         case Qt::Key_H: {
-            qDebug() << "shift left";
+            qCDebug(lcInput) << "shift left";
             //translate(-GRID_SPACING, 0);
             //rotate(45);
             QScrollBar* h = horizontalScrollBar();
@@ -80,46 +210,49 @@ void Canvas::keyPressEvent(QKeyEvent* event)
             break;
         }
         case Qt::Key_L: {
-            qDebug() << "shift right";
+            qCDebug(lcInput) << "shift right";
             //translate(GRID_SPACING, 0);
             QScrollBar* h = horizontalScrollBar();
             h->setValue(h->value() - 2*GRID_SPACING);
             break;
         }
         case Qt::Key_J: {
-            qDebug() << "shift down";
+            qCDebug(lcInput) << "shift down";
             QScrollBar* v = verticalScrollBar();
             v->setValue(v->value() - 2*GRID_SPACING);
             break;
         }
         case Qt::Key_K: {
-            qDebug() << "shift up";
+            qCDebug(lcInput) << "shift up";
             QScrollBar* v = verticalScrollBar();
             v->setValue(v->value() + 2*GRID_SPACING);
             break;
         }
         case Qt::Key_I:
             scale(1.1,1.1);
+            scheduleViewportSync();
             break;
         case Qt::Key_O:
             scale(.91,.91);
+            scheduleViewportSync();
             break;
         case Qt::Key_R: {
             rotate(45);
+            scheduleViewportSync();
             break;
         }
         case Qt::Key_T:
             emit toggleTheme();
             break;
         case Qt::Key_S:
-            qDebug() << "surround with cut";
+            qCDebug(lcInput) << "surround with cut";
             surroundNodesWithCut();
             break;
         case Qt::Key_A:
             highlighted->selectAllKids();
             break;
         case Qt::Key_E:
-            qDebug() << "erase cut but keep kids";
+            qCDebug(lcInput) << "erase cut but keep kids";
             deleteCutAndSaveOrphans();
             break;
         }
@@ -131,7 +264,7 @@ void Canvas::keyPressEvent(QKeyEvent* event)
         case Qt::Key_B:
           {
             showBounds = !showBounds;
-            qDebug() << "toggle showBounds to" << showBounds;
+            qCDebug(lcInput) << "toggle showBounds to" << showBounds;
             if (!showBounds)
               clearBounds();
           }
@@ -139,6 +272,22 @@ void Canvas::keyPressEvent(QKeyEvent* event)
         case Qt::Key_D:
             clearSelection();
             break;
+        case Qt::Key_G:
+            showGrid = !showGrid;
+            qCDebug(lcInput) << "toggle showGrid to" << showGrid;
+            viewport()->update();
+            break;
+        case Qt::Key_I:
+          {
+            setIndexMode(IndexMode((indexMode + 1) % 3));
+            qCDebug(lcInput) << "scene index mode set to" << indexMode;
+          }
+          break;
+        case Qt::Key_L:
+            qCDebug(lcInput) << "auto layout";
+            Layout::arrange(this);
+            syncViewport();
+            break;
         }
     }
 
@@ -202,11 +351,20 @@ void Canvas::mouseMoveEvent(QMouseEvent* event)
     else
     {
         if (setHighlightByKeyboard) {
-            qDebug() << "mouse moved canvas and keyboard mode";
+            qCDebug(lcInput) << "mouse moved canvas and keyboard mode";
             setHighlightByKeyboard = false;
             highlightNode(root);
         }
         lastMousePos = mapToScene(event->pos());
+
+        // Qt isn't sending hover events in nested mode, so find the deepest
+        // node under the mouse ourselves (Qt only hovers with no buttons down)
+        if (indexMode == NestedIndexMode && event->buttons() == Qt::NoButton)
+        {
+            Node* n = Node::nodeAt(root, lastMousePos);
+            if (n != highlighted)
+                setHighlight(n);
+        }
     }
     QGraphicsView::mouseMoveEvent(event);
 }
@@ -237,19 +395,22 @@ void Canvas::mouseReleaseEvent(QMouseEvent* event)
 
     if (noMouseMovement)
     {
-      qDebug() << "No mouse movement, handle as click";
+      qCDebug(lcInput) << "No mouse movement, handle as click";
       if (!highlighted->isRoot())
         highlighted->toggleSelection();
     }
     else
     {
-      qDebug() << "Need to determine selection";
+      qCDebug(lcInput) << "Need to determine selection";
       Node::setSelectionFromBox(root, selBox->rect());
     }
 
   }
 
   QGraphicsView::mouseReleaseEvent(event);
+
+  // A drag may have moved things past the scene's edge
+  scheduleViewportSync();
 }
 
 void Canvas::setHighlight(Node* node)
@@ -306,13 +467,15 @@ void Canvas::surroundNodesWithCut() {
     //selectNode(highlighted);
     Node* par = selectedNodes.first()->getParent();
 
-    qDebug() << "lastMousePos" << lastMousePos.x() << lastMousePos.y();
+    qCDebug(lcEdit) << "lastMousePos" << lastMousePos.x() << lastMousePos.y();
+
+    beginEdit();
 
     Node* n = par->addChildCut(lastMousePos);
     if (par == root)
         scene->addItem(n);
 
-    qDebug() << "created node " << n->getID();
+    qCDebug(lcEdit) << "created node " << n->getID();
 
     for (Node* s : selectedNodes) {
        n->adoptChild(s);
@@ -321,6 +484,8 @@ void Canvas::surroundNodesWithCut() {
     clearSelection();
     highlightNode(n);
     n->updateAncestors();
+
+    commitEdit();
 }
 
 void Canvas::highlightNode(Node* n) {
@@ -398,12 +563,13 @@ void Canvas::clearSelection()
     n->deselectThis();
 
   selectedNodes.clear();
+  selectedIndex.clear();
 }
 
 void Canvas::selectNode(Node* n)
 {
   // Make sure we don't add the same node twice
-  if (selectedNodes.contains(n))
+  if (selectedIndex.contains(n))
     return;
 
   // Don't want to select root
@@ -419,15 +585,42 @@ void Canvas::selectNode(Node* n)
   }
 
   n->selectThis();
-  selectedNodes.append(n);
+  addToSelection(n);
 }
 
 void Canvas::deselectNode(Node* n)
 {
-  selectedNodes.removeOne(n);
+  removeFromSelection(n);
   n->deselectThis();
 }
 
+void Canvas::addToSelection(Node* n)
+{
+  selectedIndex.insert(n, selectedNodes.size());
+  selectedNodes.append(n);
+}
+
+/*
+ * Removes n by moving the last selected node into its slot. Selections all
+ * share a parent and are used as a set, so their order doesn't matter.
+ */
+void Canvas::removeFromSelection(Node* n)
+{
+  QHash<Node*, int>::iterator it = selectedIndex.find(n);
+  if (it == selectedIndex.end())
+    return;
+
+  int slot = it.value();
+  selectedIndex.erase(it);
+
+  Node* last = selectedNodes.takeLast();
+  if (last != n)
+  {
+    selectedNodes[slot] = last;
+    selectedIndex[last] = slot;
+  }
+}
+
 QList<Node*> Canvas::getSelectedNodes()
 {
   return selectedNodes;
@@ -435,7 +628,7 @@ QList<Node*> Canvas::getSelectedNodes()
 
 QList<Node*> Canvas::selectionIncluding(Node* n)
 {
-  if (selectedNodes.contains(n))
+  if (selectedIndex.contains(n))
     return selectedNodes;
 
   clearSelection();
@@ -459,12 +652,14 @@ void Canvas::deleteCutAndSaveOrphans() {
             return;
     }
 
+    beginEdit();
+
     for (Node* n : selectedNodes) {
         Node* par = n->getParent();
 
         QList<Node*> orphans = n->getChildren();
         for (Node* o : orphans) {
-            qDebug() << "saving orphan" << o->getID();
+            qCDebug(lcEdit) << "saving orphan" << o->getID();
             QRectF oSceneDraw = o->getSceneDraw();
 
             o->removeColorDueToUnselectedParent();
@@ -484,8 +679,10 @@ void Canvas::deleteCutAndSaveOrphans() {
     }
 
     deleteSelection();
-    qDebug() << "clearing selection";
+    qCDebug(lcEdit) << "clearing selection";
     clearSelection();
+
+    commitEdit();
 }
 
 
@@ -503,6 +700,19 @@ void Canvas::addNodeToScene(Node* n) {
     scene->addItem(n);
 }
 
+/*
+ * Deletes every node, leaving an empty canvas
+ */
+void Canvas::clearDocument()
+{
+  clearSelection();
+  highlightNode(root);
+
+  beginEdit();
+  root->deleteChildren();
+  commitEdit();
+}
+
 void Canvas::deleteSelection()
 {
   if (selectedNodes.empty() || selectedNodes.first()->isRoot() )
@@ -513,15 +723,21 @@ void Canvas::deleteSelection()
   setHighlightByKeyboard = true;
 
   // Delete everything
+  beginEdit();
   for (Node* n : selectedNodes)
   {
       scene->removeItem(n);
       delete n;
   }
   selectedNodes.clear();
+  selectedIndex.clear();
+  commitEdit();
 }
 
 void Canvas::updateAll() {
+    // Collapsed subtree pixmaps were rendered with the old palette
+    QPixmapCache::clear();
+
     for (QGraphicsItem* i : scene->items() ) {
         Node* n = dynamic_cast<Node*>(i);
         if (n != nullptr)
@@ -529,3 +745,314 @@ void Canvas::updateAll() {
     }
     invalidateScene(sceneRect());
 }
+
+/// Item lookup ///
+
+/*
+ * Switches how items under the mouse get found.
+ *
+ * The Qt modes leave hover handling to the scene, and differ only in the item
+ * index the scene uses. The nested mode takes the scene index out entirely
+ * (nothing to maintain while dragging) and does hover lookups by walking down
+ * the node tree through each level's sibling index instead. Cuts are flagged
+ * as containing their children, so Qt's own queries (clicks, repaints) can
+ * skip whole subtrees as well.
+ */
+void Canvas::setIndexMode(IndexMode mode)
+{
+    indexMode = mode;
+
+    if (mode == BspIndexMode)
+    {
+        scene->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+        tuneBspDepth();
+    }
+    else
+        scene->setItemIndexMethod(QGraphicsScene::NoIndex);
+
+    root->useNestedLookup(mode == NestedIndexMode);
+}
+
+/*
+ * Picks a BSP depth so that leaves end up around BSP_LEAF_SIZE square. Qt's
+ * automatic depth is based on the item count alone, which for our (small,
+ * heavily nested) items produces far too many or too few leaves.
+ */
+void Canvas::tuneBspDepth()
+{
+    QRectF r = scene->sceneRect();
+    qreal leaves = (r.width() * r.height()) /
+                   (qreal(BSP_LEAF_SIZE) * qreal(BSP_LEAF_SIZE));
+
+    int depth = BSP_MIN_DEPTH;
+    if (leaves > 1)
+        depth = qCeil(qLn(leaves) / qLn(2.0));
+
+    scene->setBspTreeDepth(qBound(BSP_MIN_DEPTH, depth, BSP_MAX_DEPTH));
+}
+
+/// Edit transactions ///
+
+/*
+ * Opens an edit. Until the matching commitEdit, Node::updateAncestors only
+ * marks nodes as dirty instead of relaying out the ancestor chain right away.
+ * Edits can be nested; only the outermost commit does any work.
+ */
+void Canvas::beginEdit()
+{
+    ++editDepth;
+}
+
+/*
+ * Closes an edit. Once the outermost edit closes, all dirty nodes are relaid
+ * out in a single bottom-up pass: deepest nodes first, and a parent is only
+ * queued up if one of its children actually changed size.
+ */
+void Canvas::commitEdit()
+{
+    if (editDepth == 0 || --editDepth > 0)
+        return;
+
+    QMap<int, QSet<Node*>> levels;
+    for (Node* n : dirtyNodes)
+        levels[n->getDepth()].insert(n);
+    dirtyNodes.clear();
+
+    while (!levels.empty())
+    {
+        int depth = levels.lastKey();
+        QSet<Node*> level = levels.take(depth);
+
+        for (Node* n : level)
+        {
+            if (n->relayout() && !n->getParent()->isRoot())
+                levels[depth - 1].insert(n->getParent());
+        }
+    }
+
+    // Keep the scene bounds (and views) in step with the new content
+    scheduleViewportSync();
+}
+
+/*
+ * Called by a node that wants to relayout. Returns true (and remembers the
+ * node for later) if an edit is currently open.
+ */
+bool Canvas::deferLayout(Node* n)
+{
+    if (editDepth == 0)
+        return false;
+
+    dirtyNodes.insert(n);
+    return true;
+}
+
+/*
+ * Drops a node that's being deleted from the pending relayout
+ */
+void Canvas::forgetNode(Node* n)
+{
+    dirtyNodes.remove(n);
+
+    if (n == dragNode)
+    {
+        dragNode = nullptr;
+        dragPending = false;
+    }
+}
+
+/////////////////////
+/// Drag handling ///
+/////////////////////
+
+/*
+ * Records where a drag of n has got to. Mice can report far more often than
+ * the screen refreshes, so only the latest position is kept and the solve runs
+ * at most once per frame: immediately if a frame has passed since the last
+ * one, otherwise when the frame timer fires.
+ */
+void Canvas::queueDrag(Node* n, QPointF scenePos)
+{
+    dragNode = n;
+    dragScenePos = scenePos;
+    dragPending = true;
+
+    if (!dragTimer->isActive())
+    {
+        flushDrag();
+        dragTimer->start();
+    }
+}
+
+/*
+ * Runs the pending drag solve now, if there is one (e.g. right before the
+ * mouse is released, so the drop lands where the cursor actually is)
+ */
+void Canvas::flushDrag()
+{
+    if (!dragPending || dragNode == nullptr)
+        return;
+
+    dragPending = false;
+    dragNode->dragTo(dragScenePos);
+}
+
+/*
+ * Forgets the drag once the mouse is released (after the final flushDrag), so
+ * viewport syncs, held off while it was going on, run again
+ */
+void Canvas::endDrag()
+{
+    dragTimer->stop();
+    dragNode = nullptr;
+    dragPending = false;
+
+    scheduleViewportSync();
+}
+
+void Canvas::dragFrame()
+{
+    if (!dragPending)
+        return;
+
+    flushDrag();
+    dragTimer->start();
+}
+
+////////////////////////
+/// Viewport culling ///
+////////////////////////
+
+/*
+ * Makes the set of top level subtrees that have views match what's near the
+ * viewport: anything within VIEWPORT_MARGIN viewports of the visible area gets
+ * views built from its model records, and everything further away has its
+ * views released (their storage goes back to the node pool for reuse). The
+ * highlighted and selected nodes keep their views wherever they are.
+ *
+ * Also refits the scene rect first, so the scroll range follows the content,
+ * and afterwards lets the views know which cuts are collapsed at this zoom.
+ *
+ * Skipped while an edit or a drag is in progress, since both hold on to
+ * nodes; the next pan or zoom catches up.
+ */
+void Canvas::syncViewport()
+{
+    if (editDepth > 0 || dragNode != nullptr || scene->mouseGrabberItem() != nullptr)
+        return;
+
+    fitSceneRect();
+
+    QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+    qreal mx = visible.width() * VIEWPORT_MARGIN;
+    qreal my = visible.height() * VIEWPORT_MARGIN;
+    QRectF live = visible.adjusted(-mx, -my, mx, my);
+
+    QSet<Node*> pinned;
+    pinned.insert(topLevelOf(highlighted));
+    for (Node* n : selectedNodes)
+        pinned.insert(topLevelOf(n));
+
+    int built = 0, released = 0;
+    for (int c = model.firstChild(GraphModel::RootId); c != GraphModel::NoId;
+         c = model.nextSibling(c))
+    {
+        bool wanted = model.parentDraw(c).intersects(live);
+        Node* n = model.view(c);
+
+        if (wanted && n == nullptr)
+        {
+            scene->addItem(root->hydrateChild(c));
+            ++built;
+        }
+        else if (!wanted && n != nullptr && !pinned.contains(n))
+        {
+            n->releaseView();
+            ++released;
+        }
+    }
+
+    if (built > 0 || released > 0)
+        qCDebug(lcLayout) << "viewport: built" << built << "released" << released
+                          << "of" << model.count() - 1 << "records";
+
+    // Nothing inside a collapsed cut paints or caches itself at this zoom
+    root->refreshLevelOfDetail(
+                QStyleOptionGraphicsItem::levelOfDetailFromTransform(transform()));
+}
+
+/*
+ * Sizes the scene to what's in it: the bounds of every top level record (with
+ * views or without) and of what's on screen now, plus a viewport's worth of
+ * room on every side to pan or zoom out into. Including the visible area
+ * keeps the view from jumping when content goes away; including the margin
+ * means panning can always go one step further, after which the scene grows
+ * again.
+ */
+void Canvas::fitSceneRect()
+{
+    QRectF visible = mapToScene(viewport()->rect()).boundingRect();
+
+    QRectF fit = visible;
+    for (int c = model.firstChild(GraphModel::RootId); c != GraphModel::NoId;
+         c = model.nextSibling(c))
+        fit = fit.united(model.parentDraw(c));
+
+    fit.adjust(-visible.width(), -visible.height(),
+               visible.width(), visible.height());
+
+    if (fit == scene->sceneRect())
+        return;
+
+    scene->setSceneRect(fit);
+    if (indexMode == BspIndexMode)
+        tuneBspDepth();
+}
+
+/*
+ * Gives views to the top level records (so far without one) whose collision
+ * boxes overlap sceneColl. Every collision query against the root's index
+ * calls this for its query rect first, so placement, growth and drops see
+ * every top level subtree, not just the ones near the viewport. syncViewport
+ * releases them again once they're out of range.
+ */
+void Canvas::hydrateRecordsIn(const QRectF &sceneColl)
+{
+    for (int id : model.unviewedIn(sceneColl))
+    {
+        qCDebug(lcLayout) << "hydrating record" << id << "for a collision check";
+        scene->addItem(root->hydrateChild(id));
+    }
+}
+
+void Canvas::scheduleViewportSync()
+{
+    if (!viewportTimer->isActive())
+        viewportTimer->start();
+}
+
+/*
+ * Returns the top level ancestor of n (n itself if it's top level), or
+ * nullptr for the root
+ */
+Node* Canvas::topLevelOf(Node* n) const
+{
+    if (n == nullptr || n->isRoot())
+        return nullptr;
+
+    while (!n->getParent()->isRoot())
+        n = n->getParent();
+    return n;
+}
+
+void Canvas::scrollContentsBy(int dx, int dy)
+{
+    QGraphicsView::scrollContentsBy(dx, dy);
+    scheduleViewportSync();
+}
+
+void Canvas::resizeEvent(QResizeEvent* event)
+{
+    QGraphicsView::resizeEvent(event);
+    scheduleViewportSync();
+}
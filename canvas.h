@@ -2,16 +2,31 @@
 #define CANVAS_H
 
 #include <QGraphicsView>
+#include <QHash>
+#include <QSet>
+
+#include "graphmodel.h"
+#include "nodepool.h"
 
 class Node;
+class QTimer;
 
 class Canvas : public QGraphicsView
 {
     Q_OBJECT
+    friend class Bench; // bench/bench.h
 
 public:
+    // How items under the mouse are looked up
+    enum IndexMode
+    {
+        NoIndexMode,    // Qt linear scan over every item
+        BspIndexMode,   // Qt BSP tree, depth tuned to the scene rect
+        NestedIndexMode // node tree + sibling indexes, hover done by canvas
+    };
+
     Canvas(QWidget* parent = 0);
-    ~Canvas() {}
+    ~Canvas();
 
     void setHighlight(Node* node);
 
@@ -37,21 +52,53 @@ public:
 
     void removeFromScene(Node* n);
     void deleteSelection();
+    void clearDocument();
 
     Node* getRoot() { return root; }
+    NodePool &nodePool() { return pool; }
+    GraphModel &getModel() { return model; }
+    QGraphicsScene* getScene() { return scene; }
+
+    void setIndexMode(IndexMode mode);
+    IndexMode getIndexMode() const { return indexMode; }
 
     void updateAll();
 
     void addNodeToScene(Node* n);
 
+    // Edit transactions
+    void beginEdit();
+    void commitEdit();
+    bool deferLayout(Node* n);
+    void forgetNode(Node* n);
+
+    // Drag coalescing
+    void queueDrag(Node* n, QPointF scenePos);
+    void flushDrag();
+    void endDrag();
+
+    // Viewport culling
+    void hydrateRecordsIn(const QRectF &sceneColl);
+
 signals:
     void toggleTheme();
 
+public slots:
+    void syncViewport();
+
+private slots:
+    void dragFrame();
+
 private:
     //////////////
     /// Fields ///
     //////////////
 
+    // Storage for every node below, and the plain model of the tree they
+    // show; declared first so they outlive the nodes
+    NodePool pool;
+    GraphModel model;
+
     Node* root;
     Node* highlighted;
 
@@ -74,8 +121,11 @@ private:
     void mouseMoveEvent(QMouseEvent* event) override;
     void drawBackground(QPainter* painter,
                         const QRectF &rect) override;
+    void paintGrid(QPainter* painter, const QRectF &rect);
     void mousePressEvent(QMouseEvent* event) override;
     void mouseReleaseEvent(QMouseEvent* event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void resizeEvent(QResizeEvent* event) override;
 
     // Add
     void addCut();
@@ -90,8 +140,36 @@ private:
     void highlightParent();
     void highlightNode(Node* n);
 
-    // Selection
+    // Selection. selectedIndex maps each selected node to its slot in
+    // selectedNodes, so membership tests and removal are constant time
     QList<Node*> selectedNodes;
+    QHash<Node*, int> selectedIndex;
+    void addToSelection(Node* n);
+    void removeFromSelection(Node* n);
+
+    // Edit transactions
+    int editDepth;
+    QSet<Node*> dirtyNodes;
+
+    // Item lookup
+    IndexMode indexMode;
+    void tuneBspDepth();
+
+    // Drag coalescing: the latest mouse position of a drag, solved at most
+    // once per frame
+    QTimer* dragTimer;
+    Node* dragNode;
+    QPointF dragScenePos;
+    bool dragPending;
+
+    // Viewport culling: only top level subtrees near the viewport have views
+    QTimer* viewportTimer;
+    void scheduleViewportSync();
+    void fitSceneRect();
+    Node* topLevelOf(Node* n) const;
+
+    // Background
+    bool showGrid;
 
     // Debug
     bool showBounds;
@@ -20,6 +20,8 @@ void ColorPalette::setLightTheme() {
     stroke = QColor(16,16,16);
     canvas = def;
     target = QColor(214, 130, 130);
+    shadow = QColor(0, 0, 0, 90);
+    buildTools();
 }
 
 void ColorPalette::setDarkTheme() {
@@ -31,4 +33,26 @@ void ColorPalette::setDarkTheme() {
     stroke = QColor(232,232,232);
     canvas = def;
     target = QColor(214, 130, 130);
+    shadow = QColor(0, 0, 0, 140);
+    buildTools();
+}
+
+/*
+ * Rebuild the cached pens and brushes from the current theme colors
+ */
+void ColorPalette::buildTools() {
+    fills[DefaultFill]   = QBrush(def);
+    fills[HighlightFill] = QBrush(high);
+    fills[MouseDownFill] = QBrush(mouse);
+    fills[SelectFill]    = QBrush(sel);
+    fills[TargetFill]    = QBrush(target);
+
+    shadowFill = QBrush(shadow);
+    strokeLine = QPen(stroke);
+    fontLine = QPen(font);
+
+    // Background grid: the stroke color, faded, one device pixel wide
+    QColor grid = stroke;
+    grid.setAlpha(60);
+    gridLine = QPen(grid, 0);
 }
@@ -2,6 +2,8 @@
 #define COLORPALETTE_H
 
 #include <QColor>
+#include <QBrush>
+#include <QPen>
 
 /*
  * A singleton, manages colors for all nodes
@@ -10,6 +12,9 @@
 class ColorPalette
 {
 public:
+    // Fill states a node can be painted in, indexing the cached brushes
+    enum Fill { DefaultFill, HighlightFill, MouseDownFill, SelectFill, TargetFill, NumFills };
+
     static ColorPalette& getInstance();
 
     // Easy access static methods
@@ -21,6 +26,14 @@ public:
     static QColor strokeColor() { return ColorPalette::getInstance().stroke; }
     static QColor canvasColor() { return ColorPalette::getInstance().canvas; }
     static QColor targetColor() { return ColorPalette::getInstance().target; }
+    static QColor shadowColor() { return ColorPalette::getInstance().shadow; }
+
+    // Pens and brushes built once per theme, so painting never allocates
+    static const QBrush& fillBrush(Fill f) { return ColorPalette::getInstance().fills[f]; }
+    static const QBrush& shadowBrush() { return ColorPalette::getInstance().shadowFill; }
+    static const QPen& strokePen() { return ColorPalette::getInstance().strokeLine; }
+    static const QPen& fontPen() { return ColorPalette::getInstance().fontLine; }
+    static const QPen& gridPen() { return ColorPalette::getInstance().gridLine; }
 
     static void darkTheme() { ColorPalette::getInstance().setDarkTheme(); }
     static void lightTheme() { ColorPalette::getInstance().setLightTheme(); }
@@ -33,8 +46,13 @@ private:
     ColorPalette();
     void setDarkTheme();
     void setLightTheme();
+    void buildTools();
+
+    QColor def, high, mouse, sel, font, stroke, canvas, target, shadow;
 
-    QColor def, high, mouse, sel, font, stroke, canvas, target;
+    QBrush fills[NumFills];
+    QBrush shadowFill;
+    QPen strokeLine, fontLine, gridLine;
 };
 
 #endif // COLORPALETTE_H
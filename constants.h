@@ -17,5 +17,43 @@
 #define SEL_BOX_Z 10
 
 #define BORDER_RADIUS 10
+#define SHADOW_OFFSET 2
+
+// Level of detail, in on-screen pixels: statements smaller than this draw as
+// plain filled rects, and cuts smaller than this draw their whole subtree
+// from one cached pixmap
+#define LOD_STATEMENT_PX 10
+#define LOD_CUT_PX 48
+
+// Hard stop for the add placement spiral (Node::findPoint), in rings. The
+// search normally ends long before this, as soon as it clears the parent.
+#define SPIRAL_MAX_RINGS 4096
+
+// Cell size of the per-node sibling index (see spatialindex.h)
+#define INDEX_CELL_SIZE (4 * GRID_SPACING)
+
+// Target leaf size of the scene's BSP tree, used to pick a tree depth from the
+// scene rect when the BSP index mode is in use
+#define BSP_LEAF_SIZE (16 * GRID_SPACING)
+#define BSP_MIN_DEPTH 4
+#define BSP_MAX_DEPTH 18
+
+// How far past the visible area top level subtrees keep their views, as a
+// fraction of the visible width / height on each side (see
+// Canvas::syncViewport)
+#define VIEWPORT_MARGIN 0.5
+
+// Background grid tiles, in scene units (a whole number of grid squares).
+// Tiles that would come out smaller or larger than the pixel bounds on screen
+// are skipped and the grid is drawn directly instead.
+#define BACKGROUND_TILE (16 * GRID_SPACING)
+#define BACKGROUND_TILE_MIN_PX 64
+#define BACKGROUND_TILE_MAX_PX 1024
+
+// The grid isn't drawn at all once its squares are smaller than this on screen
+#define BACKGROUND_GRID_MIN_PX 4
+
+// Nodes per allocation in the canvas's node pool (see nodepool.h)
+#define NODES_PER_SLAB 256
 
 #endif // CONSTANTS_H
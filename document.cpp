@@ -0,0 +1,515 @@
+#include "document.h"
+#include "canvas.h"
+#include "node.h"
+#include "logging.h"
+#include "constants.h"
+#include "layout.h"
+
+#include <QFile>
+#include <QHash>
+#include <QSaveFile>
+#include <QTextStream>
+#include <QVector>
+#include <QtEndian>
+
+#include <cstring>
+
+/////////////////////
+/// On-disk types ///
+/////////////////////
+
+static const char MAGIC[4] = { 'E', 'G', 'G', 'B' };
+static const quint16 VERSION = 1;
+
+// Coordinates are stored as fixed point, 1/256th of a pixel
+static const qreal FIXED_SCALE = 256;
+
+enum RecordType
+{
+    RecordCut = 1,
+    RecordStatement = 2
+};
+
+struct Header
+{
+    char magic[4];
+    quint16_le version;
+    quint16_le flags;
+    quint32_le nodeCount;
+    quint32_le stringBytes;
+};
+
+struct Record
+{
+    quint8 type;
+    quint8 reserved[3];
+    qint32_le parent;      // record index, -1 for top level nodes
+    qint32_le x, y, w, h;  // drawBox in the parent's coordinates
+    quint32_le textOffset; // into the string table
+    quint32_le textLength;
+};
+
+static_assert(sizeof(Header) == 16, "document header must stay 16 bytes");
+static_assert(sizeof(Record) == 32, "document node record must stay 32 bytes");
+
+static qint32 toFixed(qreal v) { return qint32(qRound(v * FIXED_SCALE)); }
+static qreal fromFixed(qint32 v) { return qreal(v) / FIXED_SCALE; }
+
+////////////
+/// Save ///
+////////////
+
+/*
+ * Writes every node on the canvas to path. Statement text is stored once per
+ * symbol, so a proof that reuses the same few letters only stores each once.
+ */
+bool Document::save(Canvas* canvas, const QString &path)
+{
+    QVector<Record> records;
+    QByteArray strings;
+    QHash<int, QPair<quint32, quint32>> interned; // by symbol: offset, length
+    const GraphModel &model = canvas->getModel();
+
+    // Preorder walk over the model. Each stack entry carries the record index
+    // of its parent.
+    QVector<QPair<int, qint32>> stack;
+    for (int c = model.lastChild(GraphModel::RootId); c != GraphModel::NoId;
+         c = model.prevSibling(c))
+        stack.append(qMakePair(c, qint32(-1)));
+
+    while (!stack.empty())
+    {
+        QPair<int, qint32> next = stack.takeLast();
+        int n = next.first;
+        bool isCut = model.type(n) == Cut;
+
+        Record r;
+        std::memset(&r, 0, sizeof(r));
+        r.type = isCut ? RecordCut : RecordStatement;
+        r.parent = next.second;
+
+        QRectF draw = model.parentDraw(n);
+        r.x = toFixed(draw.x());
+        r.y = toFixed(draw.y());
+        r.w = toFixed(draw.width());
+        r.h = toFixed(draw.height());
+
+        if (!isCut)
+        {
+            int symbol = model.symbol(n);
+            QHash<int, QPair<quint32, quint32>>::const_iterator it =
+                    interned.constFind(symbol);
+            if (it == interned.constEnd())
+            {
+                QByteArray utf8;
+                if (symbol != SymbolTable::NoSymbol)
+                    utf8 = SymbolTable::instance().text(symbol).toUtf8();
+                it = interned.insert(symbol, qMakePair(quint32(strings.size()),
+                                                       quint32(utf8.size())));
+                strings.append(utf8);
+            }
+            r.textOffset = it.value().first;
+            r.textLength = it.value().second;
+        }
+
+        qint32 index = qint32(records.size());
+        records.append(r);
+
+        for (int c = model.lastChild(n); c != GraphModel::NoId;
+             c = model.prevSibling(c))
+            stack.append(qMakePair(c, index));
+    }
+
+    Header h;
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.flags = 0;
+    h.nodeCount = quint32(records.size());
+    h.stringBytes = quint32(strings.size());
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        qCWarning(lcIo) << "can't write" << path << file.errorString();
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    file.write(reinterpret_cast<const char*>(records.constData()),
+               qint64(records.size()) * qint64(sizeof(Record)));
+    file.write(strings);
+
+    if (!file.commit())
+    {
+        qCWarning(lcIo) << "can't write" << path << file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+////////////
+/// Load ///
+////////////
+
+/*
+ * Replaces everything on the canvas with the graph stored in path. The file
+ * is memory mapped and walked once: records are in preorder, so each node's
+ * parent has always been built by the time the node is reached. Every record
+ * is checked before the canvas is touched, so a malformed file is rejected
+ * (with the reason logged) and leaves the canvas as it was.
+ */
+bool Document::load(Canvas* canvas, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qCWarning(lcIo) << "can't open" << path << file.errorString();
+        return false;
+    }
+
+    qint64 size = file.size();
+    if (size < qint64(sizeof(Header)))
+    {
+        qCWarning(lcIo) << path << "is not an egg document";
+        return false;
+    }
+
+    // Fall back to reading when the file can't be mapped (pipes, some
+    // network file systems)
+    QByteArray contents;
+    const uchar* data = file.map(0, size);
+    if (data == nullptr)
+    {
+        contents = file.readAll();
+        data = reinterpret_cast<const uchar*>(contents.constData());
+    }
+
+    const Header* h = reinterpret_cast<const Header*>(data);
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        qCWarning(lcIo) << path << "is not an egg document";
+        return false;
+    }
+    if (h->version != VERSION)
+    {
+        qCWarning(lcIo) << path << "has unsupported version" << quint16(h->version);
+        return false;
+    }
+
+    quint32 count = h->nodeCount;
+    quint32 stringBytes = h->stringBytes;
+    if (qint64(sizeof(Header)) + qint64(count) * qint64(sizeof(Record))
+            + qint64(stringBytes) > size)
+    {
+        qCWarning(lcIo) << path << "is truncated";
+        return false;
+    }
+
+    const Record* records = reinterpret_cast<const Record*>(data + sizeof(Header));
+    const char* strings = reinterpret_cast<const char*>(records + count);
+
+    // Check every record first. Parents must come earlier and be cuts
+    // (statements can't have children), and text must lie inside the strings.
+    for (quint32 i = 0; i < count; ++i)
+    {
+        const Record &r = records[i];
+        qint32 p = r.parent;
+
+        bool ok = (p == -1 || (p >= 0 && quint32(p) < i &&
+                               records[p].type == RecordCut));
+        if (r.type == RecordStatement)
+            ok = ok && r.textOffset <= stringBytes &&
+                 r.textLength <= stringBytes - r.textOffset;
+        else if (r.type != RecordCut)
+            ok = false;
+
+        if (!ok)
+        {
+            qCWarning(lcIo) << path << "has a malformed node record at" << i;
+            return false;
+        }
+    }
+
+    // Records go straight into the model; only the part of the graph that
+    // ends up on screen gets views, once the whole file is in
+    canvas->clearDocument();
+
+    GraphModel &model = canvas->getModel();
+    QVector<int> ids(int(count), GraphModel::NoId);
+    QHash<quint32, int> symbols; // by offset, so each string is only read once
+
+    for (quint32 i = 0; i < count; ++i)
+    {
+        const Record &r = records[i];
+        int par = (r.parent == -1) ? int(GraphModel::RootId) : ids.at(r.parent);
+
+        int id;
+        if (r.type == RecordCut)
+            id = model.add(Cut, par);
+        else
+        {
+            quint32 off = r.textOffset;
+            QHash<quint32, int>::iterator it = symbols.find(off);
+            if (it == symbols.end())
+                it = symbols.insert(off, SymbolTable::instance().intern(
+                                        QString::fromUtf8(strings + off, int(r.textLength))));
+            id = model.add(Statement, par, it.value());
+        }
+
+        model.setGeometry(id, QPointF(), QRectF(fromFixed(r.x), fromFixed(r.y),
+                                                fromFixed(r.w), fromFixed(r.h)));
+        ids[int(i)] = id;
+    }
+
+    canvas->syncViewport();
+    return true;
+}
+
+////////////
+/// Text ///
+////////////
+
+// Characters read from the stream at a time while importing
+#define TEXT_CHUNK 4096
+
+/*
+ * One node read by an import: its type, the index of its parent entry (-1 for
+ * top level nodes) and, for statements, its symbol
+ */
+struct TextRecord
+{
+    NodeType type;
+    qint32 parent;
+    qint32 symbol;
+};
+
+static bool isIdentifierChar(QChar c)
+{
+    return c.isLetterOrNumber() || c == '_';
+}
+
+/*
+ * Reads the text form of a graph from in, replacing everything on the canvas:
+ *
+ *   (A (B ?) C)
+ *
+ * Parentheses are cuts, identifiers are statements and ? is a placeholder.
+ * Whitespace separates siblings, and # starts a comment running to the end of
+ * the line. The stream is consumed in chunks into a flat list of records,
+ * in preorder like the binary format, and the canvas is only touched once the
+ * whole input has parsed, so a syntax error (logged with its line) leaves the
+ * canvas as it was. The records then go straight into the canvas's GraphModel
+ * and Layout packs them there; as with load, only the part of the graph that
+ * ends up on screen gets views.
+ */
+bool Document::readText(Canvas* canvas, QTextStream &in)
+{
+    QVector<TextRecord> records;
+    QVector<qint32> open; // record indexes of the cuts still open
+    open.append(-1);
+
+    QString ident;
+    bool comment = false;
+    bool ok = true;
+    int line = 1;
+
+    // Statements are only known to be complete once a character that can't
+    // continue them is read, which may be in the next chunk
+    auto flushIdent = [&]() {
+        if (ident.isEmpty())
+            return;
+
+        records.append(TextRecord{ Statement, open.last(),
+                                   SymbolTable::instance().intern(ident) });
+        ident.clear();
+    };
+
+    while (ok && !in.atEnd())
+    {
+        const QString chunk = in.read(TEXT_CHUNK);
+
+        for (int i = 0; ok && i < chunk.size(); ++i)
+        {
+            QChar c = chunk.at(i);
+
+            if (c == '\n')
+            {
+                ++line;
+                comment = false;
+            }
+
+            if (comment)
+                continue;
+
+            if (isIdentifierChar(c))
+            {
+                ident.append(c);
+                continue;
+            }
+
+            flushIdent();
+
+            if (c.isSpace())
+                continue;
+            else if (c == '#')
+                comment = true;
+            else if (c == '?')
+                records.append(TextRecord{ Statement, open.last(),
+                                           SymbolTable::instance().intern("") });
+            else if (c == '(')
+            {
+                open.append(qint32(records.size()));
+                records.append(TextRecord{ Cut, open.at(open.size() - 2),
+                                           SymbolTable::NoSymbol });
+            }
+            else if (c == ')')
+            {
+                if (open.size() == 1)
+                {
+                    qCWarning(lcIo) << "unmatched ) on line" << line;
+                    ok = false;
+                    break;
+                }
+
+                open.removeLast();
+            }
+            else
+            {
+                qCWarning(lcIo) << "unexpected" << c << "on line" << line;
+                ok = false;
+            }
+        }
+    }
+
+    if (ok)
+        flushIdent();
+
+    if (ok && open.size() > 1)
+    {
+        qCWarning(lcIo) << open.size() - 1 << "unclosed ( at end of input";
+        ok = false;
+    }
+
+    if (!ok)
+        return false;
+
+    canvas->clearDocument();
+
+    GraphModel &model = canvas->getModel();
+    QVector<int> ids(records.size(), GraphModel::NoId);
+
+    for (int i = 0; i < records.size(); ++i)
+    {
+        const TextRecord &r = records.at(i);
+        int par = (r.parent == -1) ? int(GraphModel::RootId) : ids.at(r.parent);
+
+        if (r.type == Cut)
+            ids[i] = model.add(Cut, par);
+        else
+            ids[i] = model.add(Statement, par, r.symbol);
+    }
+
+    Layout::arrange(canvas);
+    canvas->syncViewport();
+
+    return true;
+}
+
+/*
+ * Writes the text form of the canvas to out, one top level node per line.
+ * Nodes are written as the tree is walked, so nothing is built up in memory
+ * beyond the stream's own buffer.
+ */
+void Document::writeText(Canvas* canvas, QTextStream &out)
+{
+    // Each entry is a node plus the next of its children to write (NoId once
+    // they've all been written)
+    const GraphModel &model = canvas->getModel();
+    QVector<QPair<int, int>> stack;
+
+    for (int top = model.firstChild(GraphModel::RootId); top != GraphModel::NoId;
+         top = model.nextSibling(top))
+    {
+        stack.append(qMakePair(top, model.firstChild(top)));
+
+        while (!stack.empty())
+        {
+            QPair<int, int> &next = stack.last();
+            int n = next.first;
+
+            if (model.type(n) != Cut)
+            {
+                int symbol = model.symbol(n);
+                QString letter;
+                if (symbol != SymbolTable::NoSymbol)
+                    letter = SymbolTable::instance().text(symbol);
+                out << (letter.isEmpty() ? QString("?") : letter);
+                stack.removeLast();
+            }
+            else if (model.firstChild(n) == GraphModel::NoId)
+            {
+                out << "()";
+                stack.removeLast();
+            }
+            else if (next.second != GraphModel::NoId)
+            {
+                out << (next.second == model.firstChild(n) ? "(" : " ");
+                int child = next.second;
+                next.second = model.nextSibling(child);
+                stack.append(qMakePair(child, model.firstChild(child)));
+            }
+            else
+            {
+                out << ")";
+                stack.removeLast();
+            }
+        }
+
+        out << "\n";
+    }
+
+    out.flush();
+}
+
+/*
+ * Replaces the canvas with the text form of a graph read from path
+ */
+bool Document::importText(Canvas* canvas, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        qCWarning(lcIo) << "can't open" << path << file.errorString();
+        return false;
+    }
+
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    return readText(canvas, in);
+}
+
+/*
+ * Writes the text form of the canvas to path
+ */
+bool Document::exportText(Canvas* canvas, const QString &path)
+{
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        qCWarning(lcIo) << "can't write" << path << file.errorString();
+        return false;
+    }
+
+    QTextStream out(&file);
+    out.setCodec("UTF-8");
+    writeText(canvas, out);
+
+    if (out.status() != QTextStream::Ok || !file.commit())
+    {
+        qCWarning(lcIo) << "can't write" << path << file.errorString();
+        return false;
+    }
+
+    return true;
+}
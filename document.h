@@ -0,0 +1,41 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <QString>
+
+class Canvas;
+class QTextStream;
+
+/*
+ * Saving and loading graphs.
+ *
+ * The binary format (.egg) is a flat, versioned, little-endian layout that
+ * can be memory mapped and turned back into a node tree in one linear pass:
+ *
+ *   header    16 bytes   magic "EGGB", version, node count, string bytes
+ *   nodes     32 bytes   one record per node, in preorder (so every parent
+ *             each       comes before its children)
+ *   strings              UTF-8 statement text, referenced by offset/length
+ *
+ * Each node record holds its type, the index of its parent record (-1 for
+ * top level nodes) and its drawBox in its parent's coordinates. Loading only
+ * fills in the canvas's GraphModel; views are made for what's on screen.
+ *
+ * The text format (.txt) is nested parentheses for cuts, identifiers for
+ * statements and ? for placeholders, e.g. "(A (B ?) C)". It's read and
+ * written as a stream; imported graphs are packed by Layout.
+ */
+
+class Document
+{
+public:
+    static bool save(Canvas* canvas, const QString &path);
+    static bool load(Canvas* canvas, const QString &path);
+
+    static bool importText(Canvas* canvas, const QString &path);
+    static bool exportText(Canvas* canvas, const QString &path);
+    static bool readText(Canvas* canvas, QTextStream &in);
+    static void writeText(Canvas* canvas, QTextStream &out);
+};
+
+#endif // DOCUMENT_H
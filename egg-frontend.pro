@@ -6,7 +6,7 @@
 
 QT       += core gui
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets concurrent
 
 TARGET = egg-frontend
 TEMPLATE = app
@@ -22,6 +22,9 @@ DEFINES += QT_DEPRECATED_WARNINGS
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
+# Debug logging (see logging.h) is compiled out of release builds entirely
+CONFIG(release, debug|release): DEFINES += QT_NO_DEBUG_OUTPUT
+
 
 SOURCES += \
         main.cpp \
@@ -30,7 +33,14 @@ SOURCES += \
     canvas.cpp \
     colorpalette.cpp \
     tutorialwindow.cpp \
-    aboutwindow.cpp
+    aboutwindow.cpp \
+    spatialindex.cpp \
+    logging.cpp \
+    document.cpp \
+    layout.cpp \
+    nodepool.cpp \
+    symboltable.cpp \
+    graphmodel.cpp
 
 HEADERS += \
         mainwindow.h \
@@ -39,7 +49,14 @@ HEADERS += \
     colorpalette.h \
     constants.h \
     tutorialwindow.h \
-    aboutwindow.h
+    aboutwindow.h \
+    spatialindex.h \
+    logging.h \
+    document.h \
+    layout.h \
+    nodepool.h \
+    symboltable.h \
+    graphmodel.h
 
 FORMS += \
         mainwindow.ui \
@@ -0,0 +1,251 @@
+#include "graphmodel.h"
+#include "spatialindex.h"
+#include "constants.h"
+
+#include <QSet>
+
+GraphModel::GraphModel() :
+    live(0)
+{
+    add(Root, NoId);
+}
+
+/*
+ * Adds a record for a new node as the last child of parentId, and returns its
+ * id. Position and box start out empty until the node sets them.
+ */
+int GraphModel::add(NodeType t, int parentId, int symbolId)
+{
+    int id;
+    if (freeIds.empty())
+    {
+        id = types.size();
+        types.append(quint8(t));
+        parents.append(NoId);
+        firsts.append(NoId);
+        lasts.append(NoId);
+        nexts.append(NoId);
+        prevs.append(NoId);
+        symbols.append(symbolId);
+        positions.append(QPointF());
+        draws.append(QRectF());
+        views.append(nullptr);
+        shelfRects.append(QRectF());
+    }
+    else
+    {
+        id = freeIds.takeLast();
+        types[id] = quint8(t);
+        firsts[id] = lasts[id] = NoId;
+        symbols[id] = symbolId;
+        positions[id] = QPointF();
+        draws[id] = QRectF();
+        views[id] = nullptr;
+    }
+
+    if (parentId != NoId)
+        link(id, parentId);
+
+    ++live;
+    refreshShelf(id);
+    return id;
+}
+
+/*
+ * Removes id and everything below it, freeing all of their ids
+ */
+void GraphModel::remove(int id)
+{
+    unlink(id);
+    refreshShelf(id);
+
+    QVector<int> stack;
+    stack.append(id);
+    while (!stack.empty())
+    {
+        int n = stack.takeLast();
+        for (int c = firsts.at(n); c != NoId; c = nexts.at(c))
+            stack.append(c);
+
+        parents[n] = NoId;
+        views[n] = nullptr;
+        freeIds.append(n);
+        --live;
+    }
+}
+
+/*
+ * Removes everything below id, leaving id itself
+ */
+void GraphModel::removeChildren(int id)
+{
+    while (firsts.at(id) != NoId)
+        remove(firsts.at(id));
+}
+
+/*
+ * Moves id (with its subtree) to the end of parentId's children
+ */
+void GraphModel::reparent(int id, int parentId)
+{
+    unlink(id);
+    link(id, parentId);
+    refreshShelf(id);
+}
+
+/*
+ * Forgets the views of id and everything below it
+ */
+void GraphModel::detachViews(int id)
+{
+    QVector<int> stack;
+    stack.append(id);
+    while (!stack.empty())
+    {
+        int n = stack.takeLast();
+        views[n] = nullptr;
+        for (int c = firsts.at(n); c != NoId; c = nexts.at(c))
+            stack.append(c);
+    }
+
+    refreshShelf(id);
+}
+
+void GraphModel::setView(int id, Node* n)
+{
+    views[id] = n;
+    refreshShelf(id);
+}
+
+/*
+ * Returns the top level records without views whose collision boxes overlap
+ * sceneColl
+ */
+QVector<int> GraphModel::unviewedIn(const QRectF &sceneColl) const
+{
+    QVector<int> found;
+    if (shelf.isEmpty())
+        return found;
+
+    int x1, y1, x2, y2;
+    SpatialIndex::cellRange(sceneColl, x1, y1, x2, y2);
+
+    QSet<int> seen;
+    for (int cx = x1; cx <= x2; ++cx)
+        for (int cy = y1; cy <= y2; ++cy)
+        {
+            QHash<quint64, QVector<qint32>>::const_iterator it = shelf.constFind(SpatialIndex::key(cx, cy));
+            if (it == shelf.constEnd())
+                continue;
+
+            for (int id : it.value())
+            {
+                if (!seen.contains(id) && shelfRects.at(id).intersects(sceneColl))
+                {
+                    seen.insert(id);
+                    found.append(id);
+                }
+            }
+        }
+
+    return found;
+}
+
+/*
+ * Returns the scene position of id's local origin (nodes are only ever
+ * translated, so this is the sum of the positions above it)
+ */
+QPointF GraphModel::sceneOrigin(int id) const
+{
+    QPointF origin;
+    for (int n = id; n != NoId; n = parents.at(n))
+        origin += positions.at(n);
+    return origin;
+}
+
+void GraphModel::setGeometry(int id, const QPointF &pos, const QRectF &draw)
+{
+    positions[id] = pos;
+    draws[id] = draw;
+    refreshShelf(id);
+}
+
+void GraphModel::link(int id, int parentId)
+{
+    parents[id] = parentId;
+    prevs[id] = lasts.at(parentId);
+    nexts[id] = NoId;
+
+    if (lasts.at(parentId) == NoId)
+        firsts[parentId] = id;
+    else
+        nexts[lasts.at(parentId)] = id;
+    lasts[parentId] = id;
+}
+
+void GraphModel::unlink(int id)
+{
+    int p = parents.at(id);
+    if (p == NoId)
+        return;
+
+    if (prevs.at(id) == NoId)
+        firsts[p] = nexts.at(id);
+    else
+        nexts[prevs.at(id)] = nexts.at(id);
+
+    if (nexts.at(id) == NoId)
+        lasts[p] = prevs.at(id);
+    else
+        prevs[nexts.at(id)] = prevs.at(id);
+
+    parents[id] = prevs[id] = nexts[id] = NoId;
+}
+
+/*
+ * Files id on the shelf under its current collision box if it's a top level
+ * record without a view, and takes it off otherwise. Cheap when neither the
+ * old nor the new state is on the shelf, which is the case for every record
+ * with a view.
+ */
+void GraphModel::refreshShelf(int id)
+{
+    bool wanted = parents.at(id) == RootId && views.at(id) == nullptr &&
+                  !draws.at(id).isNull();
+    QRectF r;
+    if (wanted)
+    {
+        qreal o = COLLISION_OFFSET;
+        r = parentDraw(id).adjusted(-o, -o, o, o);
+    }
+
+    const QRectF old = shelfRects.at(id);
+    if (old == r)
+        return;
+
+    int x1, y1, x2, y2;
+    if (!old.isNull())
+    {
+        SpatialIndex::cellRange(old, x1, y1, x2, y2);
+        for (int cx = x1; cx <= x2; ++cx)
+            for (int cy = y1; cy <= y2; ++cy)
+            {
+                QHash<quint64, QVector<qint32>>::iterator it = shelf.find(SpatialIndex::key(cx, cy));
+                if (it == shelf.end())
+                    continue;
+                it.value().removeOne(id);
+                if (it.value().isEmpty())
+                    shelf.erase(it);
+            }
+    }
+
+    if (!r.isNull())
+    {
+        SpatialIndex::cellRange(r, x1, y1, x2, y2);
+        for (int cx = x1; cx <= x2; ++cx)
+            for (int cy = y1; cy <= y2; ++cy)
+                shelf[SpatialIndex::key(cx, cy)].append(id);
+    }
+
+    shelfRects[id] = r;
+}
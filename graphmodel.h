@@ -0,0 +1,93 @@
+#ifndef GRAPHMODEL_H
+#define GRAPHMODEL_H
+
+#include <QHash>
+#include <QPointF>
+#include <QRectF>
+#include <QVector>
+
+class Node;
+
+enum NodeType
+{
+    Root,
+    Cut,
+    Statement,
+    Placeholder
+};
+
+/*
+ * The node tree as plain arrays, one slot per node, indexed by id.
+ *
+ * Each field (type, parent, first and last child, next and previous sibling,
+ * symbol, position in the parent's coordinates, drawBox in the node's own) is
+ * its own contiguous array, so walks over the whole tree such as saving,
+ * writing text or bulk layout run through a few flat arrays rather than
+ * chasing Node pointers. Slot RootId is always the root. Ids of removed nodes
+ * are handed out again.
+ *
+ * Nodes on the canvas are views of their record (Node::modelId) and push
+ * every change of parent, position and box into it, so the model is current
+ * whenever the tree isn't mid-edit. Only top level subtrees near the viewport
+ * have views at all (see Canvas::syncViewport); the rest exist only here.
+ *
+ * Top level records without a view are also kept on a grid by their scene
+ * collision box, so collision checks against the root can find them (see
+ * Canvas::hydrateRecordsIn) without a view for every one.
+ */
+class GraphModel
+{
+public:
+    enum { NoId = -1, RootId = 0 };
+
+    GraphModel();
+
+    int add(NodeType t, int parentId, int symbolId = -1);
+    void remove(int id);
+    void removeChildren(int id);
+    void reparent(int id, int parentId);
+    void setGeometry(int id, const QPointF &pos, const QRectF &draw);
+    void setView(int id, Node* n);
+    void detachViews(int id);
+
+    QVector<int> unviewedIn(const QRectF &sceneColl) const;
+
+    NodeType type(int id) const { return NodeType(types.at(id)); }
+    int parent(int id) const { return parents.at(id); }
+    int firstChild(int id) const { return firsts.at(id); }
+    int lastChild(int id) const { return lasts.at(id); }
+    int nextSibling(int id) const { return nexts.at(id); }
+    int prevSibling(int id) const { return prevs.at(id); }
+    int symbol(int id) const { return symbols.at(id); }
+    QPointF pos(int id) const { return positions.at(id); }
+    QRectF draw(int id) const { return draws.at(id); }
+    QRectF parentDraw(int id) const { return draws.at(id).translated(positions.at(id)); }
+    Node* view(int id) const { return views.at(id); }
+    QPointF sceneOrigin(int id) const;
+
+    int count() const { return live; }
+
+private:
+    QVector<quint8> types;
+    QVector<qint32> parents;
+    QVector<qint32> firsts, lasts;
+    QVector<qint32> nexts, prevs;
+    QVector<qint32> symbols;
+    QVector<QPointF> positions;
+    QVector<QRectF> draws;
+    QVector<Node*> views;
+
+    QVector<qint32> freeIds;
+    int live;
+
+    // Top level records without views, by grid cell. shelfRects holds the
+    // collision box each one is filed under (null when it isn't filed).
+    QHash<quint64, QVector<qint32>> shelf;
+    QVector<QRectF> shelfRects;
+
+    void link(int id, int parentId);
+    void unlink(int id);
+    void refreshShelf(int id);
+};
+
+#endif // GRAPHMODEL_H
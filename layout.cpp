@@ -0,0 +1,170 @@
+#include "layout.h"
+#include "canvas.h"
+#include "node.h"
+#include "constants.h"
+
+#include <QVector>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QtMath>
+
+#include <algorithm>
+#include <numeric>
+
+// Levels with fewer nodes than this are measured on the calling thread; below
+// it, handing the work to the pool costs more than it saves
+#define PARALLEL_LEVEL_SIZE 512
+
+/*
+ * One node of the snapshot. Sizes and offsets are in scene units; offsets are
+ * from the parent's top left.
+ */
+struct LayoutItem
+{
+    int id; // in the canvas's GraphModel
+    NodeType type;
+    QVector<int> kids;
+    qreal w, h;
+    QPointF offset;
+    QPointF tl; // final scene top left
+};
+
+static qreal toGrid(qreal v)
+{
+    return qCeil(v / qreal(GRID_SPACING)) * qreal(GRID_SPACING);
+}
+
+/*
+ * Shelf packs the kids of items[i] (already measured) and sizes items[i]
+ * around them. Kids go tallest first into rows no wider than about the
+ * square root of their total area, GRID_SPACING apart and GRID_SPACING in
+ * from the walls, which is where relayout expects them.
+ *
+ * Only touches items[i] and its kids, so different items of the same level
+ * can be measured at the same time.
+ */
+static void measure(LayoutItem* items, int i)
+{
+    LayoutItem &item = items[i];
+
+    if (item.type != Cut && item.type != Root)
+    {
+        item.w = item.h = STATEMENT_SIZE;
+        return;
+    }
+
+    if (item.kids.empty())
+    {
+        item.w = item.h = EMPTY_CUT_SIZE;
+        return;
+    }
+
+    qreal area = 0, widest = 0;
+    for (int k : item.kids)
+    {
+        area += (items[k].w + GRID_SPACING) * (items[k].h + GRID_SPACING);
+        widest = qMax(widest, items[k].w);
+    }
+    qreal rowWidth = qMax(widest, toGrid(qSqrt(area)));
+
+    QVector<int> order = item.kids;
+    std::stable_sort(order.begin(), order.end(), [items](int a, int b) {
+        return items[a].h > items[b].h;
+    });
+
+    qreal x = 0, y = 0, rowH = 0, maxX = 0;
+    for (int k : order)
+    {
+        if (x > 0 && x + items[k].w > rowWidth)
+        {
+            x = 0;
+            y += rowH + GRID_SPACING;
+            rowH = 0;
+        }
+
+        items[k].offset = QPointF(x + GRID_SPACING, y + GRID_SPACING);
+        x += items[k].w + GRID_SPACING;
+        rowH = qMax(rowH, items[k].h);
+        maxX = qMax(maxX, x - GRID_SPACING);
+    }
+
+    item.w = maxX + 2 * GRID_SPACING;
+    item.h = y + rowH + 2 * GRID_SPACING;
+}
+
+/*
+ * Lays out every node on the canvas. Top level nodes are packed like the
+ * contents of a cut, with the block's corner at the scene origin.
+ */
+void Layout::arrange(Canvas* canvas)
+{
+    // Snapshot of the model, breadth first so every parent comes before its
+    // children and each depth is one contiguous run, from levels[d] up to
+    // levels[d + 1]
+    GraphModel &model = canvas->getModel();
+    QVector<LayoutItem> items;
+    QVector<int> levels;
+    items.reserve(model.count());
+    items.append(LayoutItem{ GraphModel::RootId, Root, QVector<int>(), 0, 0, QPointF(), QPointF() });
+
+    for (int begin = 0; begin < items.size(); )
+    {
+        int end = items.size();
+        levels.append(begin);
+
+        for (int i = begin; i < end; ++i)
+        {
+            for (int c = model.firstChild(items[i].id); c != GraphModel::NoId;
+                 c = model.nextSibling(c))
+            {
+                items[i].kids.append(items.size());
+                items.append(LayoutItem{ c, model.type(c), QVector<int>(), 0, 0, QPointF(), QPointF() });
+            }
+        }
+
+        begin = end;
+    }
+    levels.append(items.size());
+
+    // Sizes, deepest level first. A cut's size only depends on its own kids,
+    // so everything within a level is independent and big levels are spread
+    // over the thread pool. Neither the model nor the nodes are touched here.
+    LayoutItem* data = items.data();
+    for (int d = levels.size() - 2; d >= 0; --d)
+    {
+        int begin = levels.at(d), end = levels.at(d + 1);
+
+        if (end - begin < PARALLEL_LEVEL_SIZE)
+        {
+            for (int i = begin; i < end; ++i)
+                measure(data, i);
+            continue;
+        }
+
+        QVector<int> level(end - begin);
+        std::iota(level.begin(), level.end(), begin);
+        QtConcurrent::blockingMap(level, [data](int &i) { measure(data, i); });
+    }
+
+    // Positions, parents before children, back on the calling (GUI) thread
+    // since this is what touches the scene. Boxes are set in place; nothing is
+    // moved, so each node's scene origin stays valid throughout, and every
+    // cut already fits its children so no relayout is needed afterwards.
+    for (int i = 0; i < items.size(); ++i)
+    {
+        const LayoutItem &item = items[i];
+        for (int k : item.kids)
+            items[k].tl = item.tl + items[k].offset;
+
+        if (i == 0)
+            continue;
+
+        // Subtrees away from the viewport have no views, just records
+        Node* node = model.view(item.id);
+        QRectF target(item.tl, QSizeF(item.w, item.h));
+        if (node != nullptr)
+            node->setDrawBoxFromPotential(target.translated(-node->getSceneOrigin()));
+        else
+            model.setGeometry(item.id, model.pos(item.id),
+                              target.translated(-model.sceneOrigin(item.id)));
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+class Canvas;
+
+/*
+ * Bulk layout for whole graphs (imports, generated graphs, tidying up).
+ *
+ * Works bottom-up over a snapshot of the canvas's GraphModel: each cut's
+ * children are shelf packed on the grid, tallest first, and the cut is sized
+ * around them. Every node's box is then set once, top-down. There are no
+ * collision checks or retries, so the whole pass is O(N log N) in the number
+ * of nodes.
+ *
+ * Measuring is spread over the global QThreadPool one depth at a time; only
+ * the final box updates run on the calling thread.
+ */
+
+class Layout
+{
+public:
+    static void arrange(Canvas* canvas);
+};
+
+#endif // LAYOUT_H
@@ -0,0 +1,6 @@
+#include "logging.h"
+
+Q_LOGGING_CATEGORY(lcInput, "egg.input", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcEdit, "egg.edit", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcLayout, "egg.layout", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcIo, "egg.io", QtWarningMsg)
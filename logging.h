@@ -0,0 +1,28 @@
+#ifndef LOGGING_H
+#define LOGGING_H
+
+#include <QLoggingCategory>
+
+/*
+ * Debug logging categories, one per subsystem. They're all off by default and
+ * can be switched on at runtime with the usual Qt rules, e.g.
+ *
+ *   QT_LOGGING_RULES="egg.layout.debug=true" ./egg-frontend
+ *
+ * Release builds define QT_NO_DEBUG_OUTPUT (see egg-frontend.pro), which
+ * removes every qCDebug statement at compile time.
+ */
+Q_DECLARE_LOGGING_CATEGORY(lcInput)  // egg.input  - key and mouse handling
+Q_DECLARE_LOGGING_CATEGORY(lcEdit)   // egg.edit   - adding, deleting, adopting
+Q_DECLARE_LOGGING_CATEGORY(lcLayout) // egg.layout - relayout and placement
+Q_DECLARE_LOGGING_CATEGORY(lcIo)     // egg.io     - saving and loading documents
+
+// For guarding debug-only work that isn't a single qCDebug statement. Always
+// false in release builds, so the guarded block compiles away entirely.
+#ifdef QT_NO_DEBUG_OUTPUT
+#define EGG_DEBUG_ENABLED(category) false
+#else
+#define EGG_DEBUG_ENABLED(category) category().isDebugEnabled()
+#endif
+
+#endif // LOGGING_H
@@ -3,6 +3,10 @@
 #include "colorpalette.h"
 #include "tutorialwindow.h"
 #include "aboutwindow.h"
+#include "document.h"
+
+#include <QFileDialog>
+#include <QMessageBox>
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
@@ -35,6 +39,53 @@ void MainWindow::on_actionNew_triggered()
     w2->show();
 }
 
+void MainWindow::on_actionOpen_triggered()
+{
+    QString path = QFileDialog::getOpenFileName(this, "Open", QString(),
+                                                "Egg graphs (*.egg)");
+    if (path.isEmpty())
+        return;
+
+    if (!Document::load(canvas, path))
+        QMessageBox::warning(this, "Open", "Couldn't open " + path);
+}
+
+void MainWindow::on_actionSave_triggered()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Save", QString(),
+                                                "Egg graphs (*.egg)");
+    if (path.isEmpty())
+        return;
+
+    if (!path.endsWith(".egg"))
+        path += ".egg";
+
+    if (!Document::save(canvas, path))
+        QMessageBox::warning(this, "Save", "Couldn't save " + path);
+}
+
+void MainWindow::on_actionImport_triggered()
+{
+    QString path = QFileDialog::getOpenFileName(this, "Import", QString(),
+                                                "Text graphs (*.txt);;All files (*)");
+    if (path.isEmpty())
+        return;
+
+    if (!Document::importText(canvas, path))
+        QMessageBox::warning(this, "Import", "Couldn't import " + path);
+}
+
+void MainWindow::on_actionText_File_triggered()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Export To Text File", QString(),
+                                                "Text graphs (*.txt)");
+    if (path.isEmpty())
+        return;
+
+    if (!Document::exportText(canvas, path))
+        QMessageBox::warning(this, "Export", "Couldn't export " + path);
+}
+
 void MainWindow::on_actionLight_triggered()
 {
    ColorPalette::lightTheme();
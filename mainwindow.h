@@ -19,6 +19,10 @@ public:
 private slots:
     void on_actionExit_triggered();
     void on_actionNew_triggered();
+    void on_actionOpen_triggered();
+    void on_actionSave_triggered();
+    void on_actionImport_triggered();
+    void on_actionText_File_triggered();
     void on_actionLight_triggered();
     void on_actionDark_triggered();
     void toggleTheme();
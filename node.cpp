@@ -2,14 +2,17 @@
 #include "node.h"
 #include "colorpalette.h"
 #include "constants.h"
+#include "logging.h"
+#include "nodepool.h"
 
 #include <QPainter>
-#include <QGraphicsDropShadowEffect>
+#include <QPixmapCache>
+#include <QStyleOptionGraphicsItem>
 #include <QGraphicsSceneHoverEvent>
 #include <QGraphicsSceneMouseEvent>
 #include <QtCore/QtMath>
-#include <QDebug>
 #include <QQueue>
+#include <QSet>
 
 
 // Forward declarations for helper functions (implementation located at end)
@@ -21,7 +24,6 @@ void printRect(const QString &s, const QRectF &r);
 void printMinMax(qreal minX, qreal minY, qreal maxX, qreal maxY);
 QList<QPointF> constructBloom(QPointF scenePos, QPointF sceneTarget);
 bool pointInRect(const QPointF &pt, const QRectF &rect);
-QList<QPointF> constructAddBloom(const QPointF &scenePos);
 bool rectSurroundedBy(QRectF inside, QRectF outside);
 
 // Static var intitial declaration
@@ -36,36 +38,59 @@ int Node::globalID = 0;
  */
 Node* Node::makeRoot(Canvas* can)
 {
-    return new Node(can, nullptr, Root, QPointF(0,0));
+    return new (can) Node(can, nullptr, Root, QPointF(0,0));
+}
+
+/*
+ * Node storage comes from the canvas's pool rather than the heap
+ */
+void* Node::operator new(size_t size, Canvas* can)
+{
+    return can->nodePool().allocate(size);
+}
+
+void Node::operator delete(void* p)
+{
+    NodePool::release(p);
+}
+
+// Only used if a constructor throws
+void Node::operator delete(void* p, Canvas* can)
+{
+    Q_UNUSED(can)
+    NodePool::release(p);
 }
 
 /*
  * Private constructor for all types of nodes
  */
-Node::Node(Canvas* can, Node* par, NodeType t, QPointF pt) :
+Node::Node(Canvas* can, Node* par, NodeType t, QPointF pt, int record) :
     myID(globalID++),
     canvas(can),
     parent(par),
+    modelId(GraphModel::NoId),
     type(t),
     highlighted(false),
     mouseDown(false),
     locked(false),
     copying(false),
     mouseOffset(0, 0),
+    symbol(SymbolTable::NoSymbol),
+    tearingDown(false),
+    keepRecord(false),
     selected(false),
     parentSelected(false),
     ghost(false),
     newParent(nullptr),
     newCopy(nullptr),
-    target(false)
+    target(false),
+    fill(ColorPalette::DefaultFill),
+    subtreeCached(false),
+    subtreeLod(0),
+    originValid(false),
+    rectsValid(false),
+    extentsValid(true)
 {
-    // Drop shadow on click and drag
-    shadow = new QGraphicsDropShadowEffect(this);
-    shadow->setEnabled(false);
-    shadow->setBlurRadius(2);
-    shadow->setOffset(2);
-    this->setGraphicsEffect(shadow);
-
     if ( isRoot() )
     {
 
@@ -74,12 +99,14 @@ Node::Node(Canvas* can, Node* par, NodeType t, QPointF pt) :
     {
         setFlag(ItemSendsGeometryChanges);
         setCacheMode(DeviceCoordinateCache);
-        setAcceptHoverEvents(true);
+        useNestedLookup(canvas->getIndexMode() == Canvas::NestedIndexMode);
         QPointF br(pt.x() + qreal(EMPTY_CUT_SIZE),
                    pt.y() + qreal(EMPTY_CUT_SIZE));
         drawBox = QRectF(pt, br);
     }
 
+    attachToModel(record);
+
     // Colors
     //gradDefault = QRadialGradient( drawBox.x() + 3,
                                    //drawBox.y() + 3,
@@ -107,41 +134,45 @@ Node::Node(Canvas* can, Node* par, NodeType t, QPointF pt) :
 }
 
 /* Statement constructor */
-Node::Node(Canvas* can, Node* par, QString s, QPointF pt) :
+Node::Node(Canvas* can, Node* par, QString s, QPointF pt, int record) :
     myID(globalID++),
     canvas(can),
     parent(par),
+    modelId(GraphModel::NoId),
     type(Statement),
     highlighted(false),
     mouseDown(false),
     locked(false),
     copying(false),
     mouseOffset(0, 0),
-    letter(s),
+    symbol(SymbolTable::instance().intern(s)),
+    tearingDown(false),
+    keepRecord(false),
     selected(false),
     parentSelected(false),
     ghost(false),
     newParent(nullptr),
     newCopy(nullptr),
-    target(false)
+    target(false),
+    fill(ColorPalette::DefaultFill),
+    subtreeCached(false),
+    subtreeLod(0),
+    originValid(false),
+    rectsValid(false),
+    extentsValid(true)
 {
     // Qt flags
     setFlag(ItemSendsGeometryChanges);
     setCacheMode(DeviceCoordinateCache);
-    setAcceptHoverEvents(true);
-
-    // Shadow
-    shadow = new QGraphicsDropShadowEffect(this);
-    shadow->setEnabled(false);
-    shadow->setBlurRadius(2);
-    shadow->setOffset(2);
-    this->setGraphicsEffect(shadow);
+    useNestedLookup(canvas->getIndexMode() == Canvas::NestedIndexMode);
 
     // Draw box
     QPointF br(pt.x() + qreal(STATEMENT_SIZE),
                pt.y() + qreal(STATEMENT_SIZE));
     drawBox = QRectF(pt, br);
 
+    attachToModel(record);
+
     // Color palette
     //gradDefault = QRadialGradient( drawBox.x() + 3,
                                    //drawBox.y() + 3,
@@ -166,24 +197,60 @@ Node::Node(Canvas* can, Node* par, QString s, QPointF pt) :
                                     //(dist(drawBox.topLeft(), drawBox.bottomRight()) * 2 ));
     //gradSelected.setColorAt(0, QColor(110, 226, 218));
     //gradSelected.setColorAt(1, QColor(0, 209, 140));
+}
+
+/*
+ * Takes my record in the canvas's model: the root's fixed slot, a new record
+ * at the end of my parent's children, or (when hydrating) an existing record,
+ * whose geometry I then take on
+ */
+void Node::attachToModel(int record)
+{
+    GraphModel &model = canvas->getModel();
 
-    // Statement font
-    font = QFont();
-    font.setPixelSize(GRID_SPACING * 2 - 6);
+    if (record != GraphModel::NoId)
+    {
+        modelId = record;
+        model.setView(modelId, this);
+        drawBox = model.draw(record);
+        setPos(model.pos(record));
+        return;
+    }
+
+    if (parent == nullptr)
+        modelId = GraphModel::RootId;
+    else
+        modelId = model.add(type, parent->modelId, symbol);
+
+    model.setView(modelId, this);
+    syncModel();
 }
 
 // Destructor
 Node::~Node()
 {
-    qDebug() << "Calling destructor";
-    if (parent != nullptr)
+    qCDebug(lcEdit) << "Calling destructor";
+    if (parent != nullptr && !parent->tearingDown)
     {
         parent->children.removeOne(this);
+        parent->unindexChild(this);
         parent->updateAncestors();
+
+        if (!keepRecord)
+            canvas->getModel().remove(modelId);
     }
 
-    for (Node* child : children)
-        delete child;
+    // Last first, so each child also comes straight off the end of Qt's list
+    // of child items
+    tearingDown = true;
+    for (int i = children.size() - 1; i >= 0; --i)
+        delete children.at(i);
+
+    if (subtreeCached)
+        QPixmapCache::remove(subtreeKey());
+
+    // Children above may have marked me dirty during an open edit
+    canvas->forgetNode(this);
 }
 
 Node* Node::addChildCut(QPointF pt, bool usePrediction)
@@ -194,8 +261,7 @@ Node* Node::addChildCut(QPointF pt, bool usePrediction)
     QPointF finalPoint;
 
     if (usePrediction) {
-        QList<QPointF> bloom = constructAddBloom(pt);
-        finalPoint = findPoint(bloom,
+        finalPoint = findPoint(pt,
                                qreal(EMPTY_CUT_SIZE),
                                qreal(EMPTY_CUT_SIZE));
     }
@@ -203,10 +269,11 @@ Node* Node::addChildCut(QPointF pt, bool usePrediction)
         finalPoint = snapPoint(pt);
 
     //Node* newChild = new Node(canvas, this, Cut, finalPoint);
-    Node* newChild = new Node(canvas, this, Cut, mapFromScene(finalPoint));
+    Node* newChild = new (canvas) Node(canvas, this, Cut, finalPoint - getSceneOrigin());
 
     children.append(newChild);
     newChild->setParentItem(this);
+    indexChild(newChild);
     updateAncestors();
 
     return newChild;
@@ -220,17 +287,17 @@ Node* Node::addChildStatement(QPointF pt, QString t, bool usePrediction)
     QPointF finalPoint;
 
     if (usePrediction) {
-        QList<QPointF> bloom = constructAddBloom(pt);
-        finalPoint = findPoint(bloom,
+        finalPoint = findPoint(pt,
                                qreal(STATEMENT_SIZE),
                                qreal(STATEMENT_SIZE));
     }
     else
         finalPoint = snapPoint(pt);
 
-    Node* newChild = new Node(canvas, this, t, mapFromScene(finalPoint));
+    Node* newChild = new (canvas) Node(canvas, this, t, finalPoint - getSceneOrigin());
     children.append(newChild);
     newChild->setParentItem(this);
+    indexChild(newChild);
     //newChild->setPos(mapFromScene(finalPoint));
     //newChild->setPos(mapFromScene(QPointF(finalPoint.x() - qreal(STATEMENT_SIZE / 2),
                                           //finalPoint.y() - qreal(STATEMENT_SIZE / 2))));
@@ -238,6 +305,80 @@ Node* Node::addChildStatement(QPointF pt, QString t, bool usePrediction)
     return newChild;
 }
 
+/*
+ * Builds views for model record id (one of my children in the model) and
+ * everything below it, exactly where the records say. Nothing moves, so
+ * there's no placement and no relayout. Returns the view of id.
+ */
+Node* Node::hydrateChild(int id)
+{
+    GraphModel &model = canvas->getModel();
+    Node* top = nullptr;
+
+    // Each entry is a record plus the view of its parent
+    QVector<QPair<Node*, int>> stack;
+    stack.append(qMakePair(this, id));
+
+    while (!stack.empty())
+    {
+        QPair<Node*, int> next = stack.takeLast();
+        Node* par = next.first;
+        int rec = next.second;
+
+        Node* n;
+        if (model.type(rec) == Cut)
+            n = new (canvas) Node(canvas, par, Cut, QPointF(), rec);
+        else
+            n = new (canvas) Node(canvas, par,
+                                  SymbolTable::instance().text(model.symbol(rec)),
+                                  QPointF(), rec);
+
+        par->children.append(n);
+        n->setParentItem(par);
+        par->indexChild(n);
+
+        if (top == nullptr)
+            top = n;
+
+        for (int c = model.lastChild(rec); c != GraphModel::NoId;
+             c = model.prevSibling(c))
+            stack.append(qMakePair(n, c));
+    }
+
+    return top;
+}
+
+/*
+ * Deletes all of my children (and everything below them) in one sweep: they
+ * skip unhooking themselves from me one by one, and my list and index are
+ * simply dropped afterwards
+ */
+void Node::deleteChildren()
+{
+    tearingDown = true;
+    for (int i = children.size() - 1; i >= 0; --i)
+        delete children.at(i);
+    tearingDown = false;
+
+    children.clear();
+    childIndex.clear();
+    canvas->getModel().removeChildren(modelId);
+    childExtents = QRectF();
+    extentsValid = true;
+    updateAncestors();
+}
+
+/*
+ * Deletes me and my subtree but leaves our model records behind, without a
+ * view. hydrateChild() on my parent brings them back.
+ */
+void Node::releaseView()
+{
+    canvas->getModel().detachViews(modelId);
+    keepRecord = true;
+    delete this;
+}
+
 
 /////////////////
 /// Highlight ///
@@ -249,7 +390,7 @@ Node* Node::addChildStatement(QPointF pt, QString t, bool usePrediction)
 void Node::setAsHighlight()
 {
     highlighted = true;
-    update();
+    refreshPaintState();
 }
 
 /*
@@ -258,7 +399,7 @@ void Node::setAsHighlight()
 void Node::removeHighlight()
 {
     highlighted = false;
-    update();
+    refreshPaintState();
 }
 
 /////////////////
@@ -273,7 +414,7 @@ void Node::selectThis()
     selected = true;
     for (Node* n : children)
         n->colorDueToSelectedParent();
-    update();
+    refreshPaintState();
 }
 
 /*
@@ -284,7 +425,7 @@ void Node::deselectThis()
     selected = false;
     for (Node* n : children)
         n->removeColorDueToUnselectedParent();
-    update();
+    refreshPaintState();
 }
 
 void Node::selectAllKids()
@@ -308,14 +449,14 @@ void Node::colorDueToSelectedParent() {
     parentSelected = true;
     for (Node* n : children)
         n->colorDueToSelectedParent();
-    update();
+    refreshPaintState();
 }
 
 void Node::removeColorDueToUnselectedParent() {
     parentSelected = false;
     for (Node* n : children)
         n->removeColorDueToUnselectedParent();
-    update();
+    refreshPaintState();
 }
 
 /*
@@ -377,13 +518,71 @@ void Node::setSelectionFromBox(Node* root, QRectF selBox)
 }
 
 
+//////////////
+/// Lookup ///
+//////////////
+
+/*
+ * (Static)
+ * Finds the deepest node whose shape (the collision box) contains the scene
+ * point pt, which is the same node Qt's hover events would end up on. Each
+ * level only looks at the children sharing pt's cell in the sibling index.
+ *
+ * Returns root if there's nothing under the point.
+ */
+Node* Node::nodeAt(Node* root, QPointF pt)
+{
+    Node* curr = root;
+
+    while (true)
+    {
+        QPointF local = pt - curr->getSceneOrigin();
+        Node* hit = nullptr;
+
+        for (Node* n : curr->childIndex.query(QRectF(local, local)))
+        {
+            if (pointInRect(pt, n->getSceneCollisionBox()))
+            {
+                hit = n;
+                break;
+            }
+        }
+
+        if (hit == nullptr)
+            return curr;
+
+        curr = hit;
+    }
+}
+
+/*
+ * Switches this subtree between Qt hover events and lookups done by the canvas
+ * (see Canvas::setIndexMode). In the nested mode, cuts also tell Qt that their
+ * children stay within their shape so that Qt can prune its own item queries.
+ */
+void Node::useNestedLookup(bool nested)
+{
+    if (!isRoot())
+    {
+        setAcceptHoverEvents(!nested);
+        if (isCut())
+            setFlag(ItemContainsChildrenInShape, nested);
+    }
+
+    for (Node* n : children)
+        n->useNestedLookup(nested);
+}
+
 ////////////////
 /// Graphics ///
 ////////////////
 
+/*
+ * The drawBox, plus room for the drop shadow drawn while dragging
+ */
 QRectF Node::boundingRect() const
 {
-    return drawBox;
+    return drawBox.adjusted(0, 0, qreal(SHADOW_OFFSET), qreal(SHADOW_OFFSET));
 }
 
 QPainterPath Node::shape() const
@@ -397,43 +596,198 @@ void Node::paint(QPainter* painter,
                  const QStyleOptionGraphicsItem* option,
                  QWidget* widget)
 {
-    Q_UNUSED(option)
     Q_UNUSED(widget)
 
     if (isRoot())
         return;
 
-    if (isStatement())
-        painter->setPen(QPen(QColor(0,0,0,0)));
-    else
-        painter->setPen(QPen(ColorPalette::strokeColor()));
+    // Level of detail. Anything inside a collapsed cut is already part of
+    // that cut's pixmap; a collapsed cut only paints its pixmap if it is the
+    // outermost collapsed one (children are never larger than their parent).
+    // Usually Qt doesn't even ask (see refreshLevelOfDetail), but cuts can
+    // shrink between viewport syncs.
+    qreal lod = option->levelOfDetailFromTransform(painter->worldTransform());
+    if (parent->isCollapsedAt(lod))
+        return;
 
-    if (selected || parentSelected)
-        painter->setBrush(QBrush(ColorPalette::selectColor()));
-    else if (target)
-        painter->setBrush(QBrush(ColorPalette::targetColor()));
-    else if (mouseDown)
-        painter->setBrush(QBrush(ColorPalette::mouseDownColor()));
-    else if (highlighted)
-        painter->setBrush(QBrush(ColorPalette::highlightColor()));
-    else
-        painter->setBrush(QBrush(ColorPalette::defaultColor()));
+    if (isCollapsedAt(lod))
+    {
+        paintCollapsed(painter, lod);
+        return;
+    }
 
-    if (ghost || copying)
-        setOpacity(0.5);
+    // Drop shadow on click and drag. Drawn here rather than through a
+    // QGraphicsEffect, which would force offscreen rendering of every node
+    // (and defeat the item cache) just to sit disabled most of the time
+    if (mouseDown)
+    {
+        painter->setPen(Qt::NoPen);
+        painter->setBrush(ColorPalette::shadowBrush());
+        painter->drawRoundedRect(drawBox.translated(qreal(SHADOW_OFFSET),
+                                                    qreal(SHADOW_OFFSET)),
+                                 qreal(BORDER_RADIUS), qreal(BORDER_RADIUS));
+    }
+
+    paintBody(painter, lod);
+}
+
+/*
+ * Draw this node alone (no shadow, no children) in local coordinates.
+ * Statements that would be smaller than LOD_STATEMENT_PX on screen skip the
+ * rounding and the letter.
+ */
+void Node::paintBody(QPainter* painter, qreal lod) const
+{
+    if (isStatement() && qreal(STATEMENT_SIZE) * lod < qreal(LOD_STATEMENT_PX))
+    {
+        painter->fillRect(drawBox, ColorPalette::fillBrush(fill));
+        return;
+    }
+
+    if (isStatement())
+        painter->setPen(Qt::NoPen);
     else
-        setOpacity(1.0);
+        painter->setPen(ColorPalette::strokePen());
 
+    painter->setBrush(ColorPalette::fillBrush(fill));
     painter->drawRoundedRect(drawBox, qreal(BORDER_RADIUS), qreal(BORDER_RADIUS));
 
     if ( isStatement() )
     {
-        painter->setPen(QPen(ColorPalette::fontColor()));
-        painter->setFont(font);
-        painter->drawText( drawBox, Qt::AlignCenter, letter );
+        const QStaticText &glyph = SymbolTable::instance().glyph(symbol);
+        QSizeF sz = glyph.size();
+        painter->setPen(ColorPalette::fontPen());
+        painter->setFont(SymbolTable::font());
+        painter->drawStaticText(QPointF(drawBox.center().x() - sz.width() / 2,
+                                        drawBox.center().y() - sz.height() / 2),
+                                glyph);
     }
 }
 
+/*
+ * Draw this node and everything below it onto painter, in my coordinates
+ */
+void Node::paintSubtree(QPainter* painter, qreal lod) const
+{
+    paintBody(painter, lod);
+
+    for (Node* child : children)
+    {
+        painter->save();
+        painter->translate(child->pos());
+        child->paintSubtree(painter, lod);
+        painter->restore();
+    }
+}
+
+/*
+ * Marks everything inside a cut that's collapsed at lod as having no contents,
+ * without an item cache of its own, so Qt neither calls paint() on it nor
+ * keeps (and re-renders at every zoom step) a pixmap for it; the collapsed
+ * cut's pixmap already shows it. Everything else gets both back. The canvas
+ * calls this on the root after each viewport sync, i.e. after every zoom.
+ */
+void Node::refreshLevelOfDetail(qreal lod, bool insideCollapsed)
+{
+    if (!isRoot() && flags().testFlag(ItemHasNoContents) != insideCollapsed)
+    {
+        setFlag(ItemHasNoContents, insideCollapsed);
+        setCacheMode(insideCollapsed ? NoCache : DeviceCoordinateCache);
+    }
+
+    bool collapsed = insideCollapsed || isCollapsedAt(lod);
+    for (Node* child : children)
+        child->refreshLevelOfDetail(lod, collapsed);
+}
+
+/*
+ * True if this is a cut that would be smaller than LOD_CUT_PX on screen
+ */
+bool Node::isCollapsedAt(qreal lod) const
+{
+    return isCut() &&
+           qMax(drawBox.width(), drawBox.height()) * lod < qreal(LOD_CUT_PX);
+}
+
+QString Node::subtreeKey() const
+{
+    return QStringLiteral("egg-subtree-%1").arg(myID);
+}
+
+/*
+ * Paint my whole subtree from the pixmap cache, rendering it first if the
+ * cached copy is missing or was made at a different zoom
+ */
+void Node::paintCollapsed(QPainter* painter, qreal lod)
+{
+    QPixmap pm;
+    if (!subtreeCached || !qFuzzyCompare(subtreeLod, lod) ||
+            !QPixmapCache::find(subtreeKey(), &pm))
+    {
+        // One pixel of margin on each side for the stroke
+        QSize size = QSizeF(drawBox.size() * lod).toSize() + QSize(2, 2);
+        pm = QPixmap(size);
+        pm.fill(Qt::transparent);
+
+        QPainter p(&pm);
+        p.setRenderHints(painter->renderHints());
+        p.translate(1, 1);
+        p.scale(lod, lod);
+        p.translate(-drawBox.topLeft());
+        paintSubtree(&p, lod);
+        p.end();
+
+        subtreeCached = QPixmapCache::insert(subtreeKey(), pm);
+        subtreeLod = lod;
+    }
+
+    QPointF margin(1 / lod, 1 / lod);
+    painter->drawPixmap(QRectF(drawBox.topLeft() - margin,
+                               QSizeF(pm.size()) / lod),
+                        pm, QRectF(pm.rect()));
+}
+
+/*
+ * Something in my subtree changed: drop the cached pixmaps of myself and
+ * every ancestor, and repaint the ones that had one
+ */
+void Node::dropSubtreePixmap()
+{
+    for (Node* n = this; n != nullptr && !n->isRoot(); n = n->parent)
+    {
+        if (!n->subtreeCached)
+            continue;
+
+        QPixmapCache::remove(n->subtreeKey());
+        n->subtreeCached = false;
+        n->update();
+    }
+}
+
+/*
+ * Recompute the fill and opacity used by paint() after one of the
+ * highlight / selection / drag flags changed. Keeping this out of paint()
+ * means painting never touches item state (setOpacity from inside paint
+ * schedules yet another repaint).
+ */
+void Node::refreshPaintState()
+{
+    if (selected || parentSelected)
+        fill = ColorPalette::SelectFill;
+    else if (target)
+        fill = ColorPalette::TargetFill;
+    else if (mouseDown)
+        fill = ColorPalette::MouseDownFill;
+    else if (highlighted)
+        fill = ColorPalette::HighlightFill;
+    else
+        fill = ColorPalette::DefaultFill;
+
+    setOpacity((ghost || copying) ? 0.5 : 1.0);
+    dropSubtreePixmap();
+    update();
+}
+
 //////////////
 /// Sizing ///
 //////////////
@@ -468,20 +822,196 @@ QRectF Node::toDraw(QRectF coll) const
  */
 QRectF Node::getSceneCollisionBox(qreal deltaX, qreal deltaY) const
 {
-    QRectF c = toCollision(drawBox);
-    return QRectF(mapToScene( QPointF(c.topLeft().x() + deltaX,
-                                      c.topLeft().y() + deltaY)),
-                  mapToScene( QPointF(c.bottomRight().x() + deltaX,
-                                      c.bottomRight().y() + deltaY )));
+    if (!originValid || !rectsValid)
+        updateSceneCache();
+
+    return cachedSceneColl.translated(deltaX, deltaY);
 }
 
 /*
- * Similar to getSceneCollisionBox, except for a drawBox instead. This isn't
- * super efficient implemented this way, but it's not a big deal and I'm lazy
+ * Similar to getSceneCollisionBox, except for a drawBox instead
  */
 QRectF Node::getSceneDraw(qreal deltaX, qreal deltaY) const
 {
-    return toDraw(getSceneCollisionBox(deltaX, deltaY));
+    if (!originValid || !rectsValid)
+        updateSceneCache();
+
+    return cachedSceneDraw.translated(deltaX, deltaY);
+}
+
+/*
+ * Returns where my local (0,0) sits in the scene. This is cached, and built off
+ * of the (also cached) origin of my parent item, so a valid origin always
+ * implies that all of my ancestors have a valid origin too.
+ */
+QPointF Node::getSceneOrigin() const
+{
+    if (!originValid)
+    {
+        Node* p = static_cast<Node*>(parentItem());
+        cachedOrigin = pos();
+        if (p != nullptr)
+            cachedOrigin += p->getSceneOrigin();
+
+        originValid = true;
+        rectsValid = false;
+    }
+
+    return cachedOrigin;
+}
+
+/*
+ * Rebuilds the scene mapped drawBox and collision box
+ */
+void Node::updateSceneCache() const
+{
+    QPointF origin = getSceneOrigin();
+    cachedSceneDraw = drawBox.translated(origin);
+    cachedSceneColl = toCollision(drawBox).translated(origin);
+    rectsValid = true;
+}
+
+/*
+ * Call when I (and therefore my whole subtree) moved in the scene. Since a
+ * valid origin requires a valid parent origin, we can stop as soon as we hit a
+ * node that's already invalid: everything below it must be invalid as well.
+ */
+void Node::invalidateSceneGeometry()
+{
+    if (!originValid)
+        return;
+
+    originValid = false;
+    rectsValid = false;
+
+    for (Node* n : children)
+        n->invalidateSceneGeometry();
+}
+
+/////////////////////
+/// Sibling index ///
+/////////////////////
+
+/*
+ * Adds a (new or adopted) child to my index and extents. The child's collision
+ * box is stored in my coordinates, which is simply its own box offset by its
+ * pos (top level nodes are in scene coords, which are root's coords as well).
+ */
+void Node::indexChild(Node* n)
+{
+    n->syncModel();
+    n->indexedRect = toCollision(n->getParentDraw());
+    childIndex.insert(n, n->indexedRect);
+
+    if (extentsValid)
+        childExtents = childExtents.united(n->getParentDraw());
+}
+
+/*
+ * Removes a child from my index and extents (deleted or adopted elsewhere)
+ */
+void Node::unindexChild(Node* n)
+{
+    if (n->indexedRect.isNull())
+        return;
+
+    childIndex.remove(n, n->indexedRect);
+
+    if (extentsValid && onExtentsBoundary(toDraw(n->indexedRect)))
+        extentsValid = false;
+
+    n->indexedRect = QRectF();
+}
+
+/*
+ * Call whenever my drawBox or pos changes to keep my parent's index and
+ * extents in sync
+ */
+void Node::reindex()
+{
+    syncModel();
+
+    if (parent == nullptr || indexedRect.isNull())
+        return;
+
+    QRectF r = toCollision(getParentDraw());
+    parent->childIndex.move(this, indexedRect, r);
+
+    if (parent->extentsValid)
+    {
+        if (parent->onExtentsBoundary(toDraw(indexedRect)))
+            parent->extentsValid = false;
+        else
+            parent->childExtents = parent->childExtents.united(toDraw(r));
+    }
+
+    indexedRect = r;
+}
+
+/*
+ * Pushes my position and drawBox into my model record
+ */
+void Node::syncModel()
+{
+    canvas->getModel().setGeometry(modelId, pos(), drawBox);
+}
+
+/*
+ * Returns my drawBox in my parent's coords
+ */
+QRectF Node::getParentDraw() const
+{
+    return drawBox.translated(pos());
+}
+
+/*
+ * Returns the union of my children's drawBoxes in my coords. This is kept up
+ * to date incrementally as children are added, moved and resized, so it only
+ * needs a full rescan after a child that defined part of the boundary moved
+ * inwards or went away.
+ */
+QRectF Node::getChildExtents() const
+{
+    if (!extentsValid)
+    {
+        childExtents = QRectF();
+        for (Node* child : children)
+            childExtents = childExtents.united(child->getParentDraw());
+
+        extentsValid = true;
+    }
+
+    return childExtents;
+}
+
+/*
+ * Whether the rect (in my coords) touches the edge of my child extents, i.e.
+ * whether removing it could shrink them
+ */
+bool Node::onExtentsBoundary(const QRectF &r) const
+{
+    return r.left() <= childExtents.left() ||
+           r.top() <= childExtents.top() ||
+           r.right() >= childExtents.right() ||
+           r.bottom() >= childExtents.bottom();
+}
+
+/*
+ * Qt hook for position and parent changes (position changes are only sent for
+ * cuts and statements, since they set the ItemSendsGeometryChanges flag)
+ */
+QVariant Node::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if (change == ItemPositionHasChanged)
+    {
+        invalidateSceneGeometry();
+        dropSubtreePixmap();
+        reindex();
+    }
+    else if (change == ItemParentHasChanged)
+        invalidateSceneGeometry();
+
+    return QGraphicsObject::itemChange(change, value);
 }
 
 /*
@@ -498,8 +1028,11 @@ Node* Node::copyMeToParent() {
 
     Node* copy;
 
+    // Every add below would otherwise relayout the ancestors of the copy
+    canvas->beginEdit();
+
     if (isStatement()) {
-        copy = parent->addChildStatement(getSceneDraw().topLeft(), letter, false);
+        copy = parent->addChildStatement(getSceneDraw().topLeft(), getLetter(), false);
     }
     else if (isCut()) {
         copy = parent->addChildCut(getSceneDraw().topLeft());
@@ -521,7 +1054,7 @@ Node* Node::copyMeToParent() {
             if (originalCurr->isCut())
                 child = newParent->addChildCut(originalCurr->getSceneDraw().topLeft(), false);
             else if (originalCurr->isStatement())
-                child = newParent->addChildStatement(originalCurr->getSceneDraw().topLeft(), originalCurr->letter, false);
+                child = newParent->addChildStatement(originalCurr->getSceneDraw().topLeft(), originalCurr->getLetter(), false);
 
             // Recurse down
             for (Node* originalChild : originalCurr->children) {
@@ -531,6 +1064,8 @@ Node* Node::copyMeToParent() {
         }
     }
 
+    canvas->commitEdit();
+
     copy->locked = true;
 
     if (parent->isRoot())
@@ -543,15 +1078,36 @@ Node* Node::copyMeToParent() {
  * Recursive function to update all draw boxes from child boxes.
  *
  * Call this on the parent of an added or deleted node, and it'll make sure to
- * update all the way up the tree
+ * update all the way up the tree. If the canvas has an edit open, the node is
+ * just marked dirty and gets relaid out once the edit is committed.
  */
 void Node::updateAncestors()
 {
-    qDebug() << "node " << myID << "updating ancestors";
+    qCDebug(lcLayout) << "node " << myID << "updating ancestors";
 
     if (isRoot())
         return;
 
+    dropSubtreePixmap();
+
+    if (canvas->deferLayout(this))
+        return;
+
+    if (relayout())
+        parent->updateAncestors();
+}
+
+/*
+ * Recomputes my drawBox from my children (non recursive).
+ *
+ * Returns true if the drawBox changed, in which case my parent needs to be
+ * relaid out as well.
+ */
+bool Node::relayout()
+{
+    if (isRoot())
+        return false;
+
     QRectF myNewDrawBox = predictMySceneDraw(QList<Node*>(), QList<QRectF>());
     QRectF sceneDraw = getSceneDraw();
 
@@ -564,18 +1120,25 @@ void Node::updateAncestors()
          myNewDrawBox.right() != sceneDraw.right() ||
          myNewDrawBox.bottom() != sceneDraw.bottom() )
     {
-        qDebug() << "drawbox did change";
+        qCDebug(lcLayout) << "drawbox did change";
         // New draw box, so we have to update it
-        QPointF tl = mapFromScene(myNewDrawBox.topLeft());
-        QPointF br = mapFromScene(myNewDrawBox.bottomRight());
-
-        setDrawBoxFromPotential(QRectF(tl, br));
-        parent->updateAncestors();
-    }
-    else {
-        qDebug() << "drawbox stayed the same";
+        setDrawBoxFromPotential(myNewDrawBox.translated(-getSceneOrigin()));
+        return true;
     }
 
+    qCDebug(lcLayout) << "drawbox stayed the same";
+    return false;
+}
+
+/*
+ * Number of steps between me and root
+ */
+int Node::getDepth() const
+{
+    int depth = 0;
+    for (Node* curr = parent; curr != nullptr; curr = curr->parent)
+        ++depth;
+    return depth;
 }
 
 //////////////////////////
@@ -623,6 +1186,10 @@ bool Node::checkPotential(QList<Node*> changedNodes, QPointF pt)
     {
         QList<QRectF> alteredDraws;
 
+        QSet<Node*> changedSet;
+        for (Node* n : changedNodes)
+            changedSet.insert(n);
+
         // This is kind of confusing: basically, at each stage, check each of
         // the items in the changedNodes list against all of its siblings that
         // aren't also changed... i.e. check the moved nodes against the nodes
@@ -635,10 +1202,19 @@ bool Node::checkPotential(QList<Node*> changedNodes, QPointF pt)
             Node* changed = (*itn);
             QRectF changedRect = (*itr);
 
+            // Siblings whose collision boxes overlap ours, straight from the
+            // index. Overlapping drawboxes imply overlapping collision boxes,
+            // so this covers the statement case below too.
+            QRectF changedColl = changed->toCollision(changedRect);
+            if (parent->isRoot())
+                parent->canvas->hydrateRecordsIn(changedColl);
+            QList<Node*> nearby =
+                    parent->childIndex.hits(changedColl.translated(-parent->getSceneOrigin()));
+
             // Compare a changed node against each non changed node
-            for (Node* n : parent->children)
+            for (Node* n : nearby)
             {
-                if (!changedNodes.contains(n) )
+                if (!changedSet.contains(n))
                 {
                     // Both statements, so only compare drawboxes (allows
                     // statements to be closer together visually)
@@ -650,12 +1226,9 @@ bool Node::checkPotential(QList<Node*> changedNodes, QPointF pt)
                     }
                     else
                     {
-                        // Compare the collision boxes, since at least one of
+                        // The collision boxes overlap, and at least one of
                         // the nodes to compare is a cut
-                        if (rectsCollide(n->getSceneCollisionBox(),
-                                         changed->toCollision(changedRect)))
-                            return false;
-
+                        return false;
                     }
                 }
             }
@@ -699,13 +1272,207 @@ bool Node::checkPotential(QList<Node*> changedNodes, QPointF pt)
     {
         Node* n = (*itn);
         QRectF r = (*itr);
-        n->setDrawBoxFromPotential(QRectF(n->mapFromScene(r.topLeft()),
-                                          n->mapFromScene(r.bottomRight())));
+        n->setDrawBoxFromPotential(r.translated(-n->getSceneOrigin()));
     }
 
     return true;
 }
 
+/*
+ * Batched checkPotential for the drag hot path: tries each delta in deltas in
+ * order and returns the index of the first one sel can be moved by, or -1 if
+ * none of them work. As with checkPotential, the ancestors of sel are updated
+ * for the winning delta, but sel itself isn't moved.
+ *
+ * Work shared between deltas:
+ *   - the current drawBoxes of sel
+ *   - the siblings that could be hit by any of the deltas, found with one
+ *     index lookup per selected node covering the whole spread of deltas
+ *   - for each ancestor, its current drawBox and the siblings its walls could
+ *     reach by growing under any of the deltas, found with one index lookup
+ *     per ancestor against the box it would grow to if sel were swept over
+ *     the whole spread (growth only ever follows the children outwards, so
+ *     that box holds every delta's)
+ * Most drag steps don't resize the parent, in which case nothing above it can
+ * change and the ancestors are never visited; their data is only gathered
+ * once a delta first grows the parent. Each growing delta then just predicts
+ * the ancestors' new boxes, stopping at the first one that keeps its size,
+ * and checks them against the gathered siblings.
+ */
+int Node::firstValidDelta(QList<Node*> sel, const QList<QPointF> &deltas)
+{
+    if (sel.empty() || sel.first()->isRoot() || deltas.empty())
+        return -1;
+
+    Node* parent = sel.first()->parent;
+    QPointF origin = parent->getSceneOrigin();
+
+    QSet<Node*> moving;
+    for (Node* n : sel)
+        moving.insert(n);
+
+    // How far the deltas reach in each direction
+    qreal minDx = 0, minDy = 0, maxDx = 0, maxDy = 0;
+    for (const QPointF &d : deltas)
+    {
+        minDx = qMin(minDx, d.x());
+        minDy = qMin(minDy, d.y());
+        maxDx = qMax(maxDx, d.x());
+        maxDy = qMax(maxDy, d.y());
+    }
+
+    // Each selected node's box, and the siblings it could run into
+    struct Obstacle
+    {
+        QRectF draw, coll;
+        bool statement;
+    };
+
+    QList<QRectF> baseDraws;
+    QVector<QVector<Obstacle>> obstacles;
+
+    for (Node* n : sel)
+    {
+        QRectF draw = n->getSceneDraw();
+        baseDraws.append(draw);
+
+        QRectF sweep = n->toCollision(draw).adjusted(minDx, minDy, maxDx, maxDy);
+        if (parent->isRoot())
+            parent->canvas->hydrateRecordsIn(sweep);
+        QVector<Obstacle> near;
+        for (Node* other : parent->childIndex.hits(sweep.translated(-origin)))
+        {
+            if (moving.contains(other))
+                continue;
+            near.append(Obstacle{ other->getSceneDraw(),
+                                  other->getSceneCollisionBox(),
+                                  other->isStatement() });
+        }
+        obstacles.append(near);
+    }
+
+    QRectF parentDraw = parent->getSceneDraw();
+
+    // Each ancestor (parent first) with the collision boxes of the siblings
+    // its grown walls could run into. Ancestors are cuts, so only collision
+    // boxes are compared.
+    struct Level
+    {
+        Node* node;
+        QRectF draw;
+        QVector<QRectF> near;
+    };
+
+    QVector<Level> levels;
+    bool haveLevels = false;
+
+    for (int d = 0; d < deltas.size(); ++d)
+    {
+        const QPointF &pt = deltas.at(d);
+        QList<QRectF> moved;
+        bool ok = true;
+
+        for (int i = 0; ok && i < sel.size(); ++i)
+        {
+            QRectF r = baseDraws.at(i).translated(pt);
+            QRectF coll = sel.at(i)->toCollision(r);
+            bool statement = sel.at(i)->isStatement();
+
+            // Same rules as checkPotential: statements against statements
+            // only compare drawboxes
+            for (const Obstacle &o : obstacles.at(i))
+            {
+                if ((statement && o.statement) ? rectsCollide(o.draw, r)
+                                               : rectsCollide(o.coll, coll))
+                {
+                    ok = false;
+                    break;
+                }
+            }
+
+            moved.append(r);
+        }
+
+        if (!ok)
+            continue;
+
+        if (parent->isRoot())
+            return d;
+
+        // Parent keeps its size, so nothing further up moves either
+        QRectF grown = parent->predictMySceneDraw(sel, moved);
+        if (grown == parentDraw)
+            return d;
+
+        if (!haveLevels)
+        {
+            haveLevels = true;
+
+            QList<QRectF> swept;
+            for (const QRectF &r : baseDraws)
+                swept.append(r.adjusted(minDx, minDy, maxDx, maxDy));
+            QRectF reach = parent->predictMySceneDraw(sel, swept);
+
+            for (Node* a = parent; !a->isRoot(); a = a->parent)
+            {
+                Level level = { a, a->getSceneDraw(), QVector<QRectF>() };
+
+                Node* up = a->parent;
+                QRectF reachColl = a->toCollision(reach);
+                if (up->isRoot())
+                    up->canvas->hydrateRecordsIn(reachColl);
+                for (Node* other : up->childIndex.hits(reachColl.translated(-up->getSceneOrigin())))
+                {
+                    if (other != a)
+                        level.near.append(other->getSceneCollisionBox());
+                }
+                levels.append(level);
+
+                if (!up->isRoot())
+                    reach = up->predictMySceneDraw(QList<Node*>() << a,
+                                                   QList<QRectF>() << reach);
+            }
+        }
+
+        // Follow the growth up, until an ancestor keeps its size
+        QList<QRectF> grownDraws;
+        for (int k = 0; ok && k < levels.size(); ++k)
+        {
+            const Level &level = levels.at(k);
+            if (k > 0)
+                grown = level.node->predictMySceneDraw(
+                            QList<Node*>() << levels.at(k - 1).node,
+                            QList<QRectF>() << grown);
+            if (grown == level.draw)
+                break;
+
+            QRectF grownColl = level.node->toCollision(grown);
+            for (const QRectF &o : level.near)
+            {
+                if (rectsCollide(o, grownColl))
+                {
+                    ok = false;
+                    break;
+                }
+            }
+
+            grownDraws.append(grown);
+        }
+
+        if (!ok)
+            continue;
+
+        for (int k = 0; k < grownDraws.size(); ++k)
+        {
+            Node* a = levels.at(k).node;
+            a->setDrawBoxFromPotential(grownDraws.at(k).translated(-a->getSceneOrigin()));
+        }
+        return d;
+    }
+
+    return -1;
+}
+
 /*
  * Takes in a set of nodes and their adjusted drawBoxes, and constructs my
  * resulting drawBox mapped to scene coords.
@@ -758,48 +1525,78 @@ QRectF Node::predictMySceneDraw(QList<Node*> altNodes, QList<QRectF> altDraws)
     minX = minY = BIG_NUMBER;
     maxX = maxY = -BIG_NUMBER;
 
-    for (Node* child : children)
+    QPointF origin = getSceneOrigin();
+
+    // Fast path: if none of the altered children sit on the boundary of my
+    // running extents, the other children still define that boundary and the
+    // altered boxes can simply be added on top
+    QRectF ext = getChildExtents();
+    bool altOnBoundary = false;
+    for (Node* n : altNodes)
     {
-        QPointF tl, br;
-        bool usedAlt = false;
-
-        // Check if this child is in altNodes
-        // NOTE: this is a bit convoluted because I used parallel lists. I
-        // should have used a smarter data structure, or even a list of pairs
-        // but oh well.
-        QList<Node*>::iterator itn = altNodes.begin();
-        QList<QRectF>::iterator itr = altDraws.begin();
-        for (; itn != altNodes.end(); ++itn, ++itr)
+        if (onExtentsBoundary(n->getParentDraw()))
         {
-            Node* n = (*itn);
-            QRectF r = (*itr);
+            altOnBoundary = true;
+            break;
+        }
+    }
+
+    if (!altOnBoundary)
+    {
+        for (const QRectF &r : altDraws)
+            ext = ext.united(r.translated(-origin));
 
-            if (n == child)
+        minX = ext.left();
+        minY = ext.top();
+        maxX = ext.right();
+        maxY = ext.bottom();
+    }
+    else
+    {
+        for (Node* child : children)
+        {
+            QPointF tl, br;
+            bool usedAlt = false;
+
+            // Check if this child is in altNodes
+            // NOTE: this is a bit convoluted because I used parallel lists. I
+            // should have used a smarter data structure, or even a list of pairs
+            // but oh well.
+            QList<Node*>::iterator itn = altNodes.begin();
+            QList<QRectF>::iterator itr = altDraws.begin();
+            for (; itn != altNodes.end(); ++itn, ++itr)
             {
-                usedAlt = true;
-                tl = mapFromScene(r.topLeft());
-                br = mapFromScene(r.bottomRight());
-                break;
+                Node* n = (*itn);
+                QRectF r = (*itr);
+
+                if (n == child)
+                {
+                    usedAlt = true;
+                    tl = r.topLeft() - origin;
+                    br = r.bottomRight() - origin;
+                    break;
+                }
             }
-        }
 
-        // We didn't set tl & br yet, since this node wasn't an altNode,
-        // therefore use the existing sceneDraw box for the coords instead
-        if (!usedAlt)
-        {
-            tl = mapFromScene(child->getSceneDraw().topLeft());
-            br = mapFromScene(child->getSceneDraw().bottomRight());
-        }
+            // We didn't set tl & br yet, since this node wasn't an altNode,
+            // therefore use the existing sceneDraw box for the coords instead
+            if (!usedAlt)
+            {
+                QRectF childDraw = child->getSceneDraw();
+                tl = childDraw.topLeft() - origin;
+                br = childDraw.bottomRight() - origin;
+            }
 
-        // Update the min and max values with these new points
-        if (tl.x() < minX)
-            minX = tl.x();
-        if (tl.y() < minY)
-            minY = tl.y();
-        if (br.x() > maxX)
-            maxX = br.x();
-        if (br.y() > maxY)
-            maxY = br.y();
+            // Update the min and max values with these new points
+            if (tl.x() < minX)
+                minX = tl.x();
+            if (tl.y() < minY)
+                minY = tl.y();
+            if (br.x() > maxX)
+                maxX = br.x();
+            if (br.y() > maxY)
+                maxY = br.y();
+        }
     }
 
     // Calculated points are a draw box in parent coords
@@ -809,9 +1606,7 @@ QRectF Node::predictMySceneDraw(QList<Node*> altNodes, QList<QRectF> altDraws)
                           maxY + qreal(GRID_SPACING));
 
     // Convert back to scene
-    QPointF tls = mapToScene(tlp);
-    QPointF brs = mapToScene(brp);
-    return QRectF(tls, brs);
+    return QRectF(tlp + origin, brp + origin);
 }
 
 /*
@@ -823,6 +1618,9 @@ void Node::setDrawBoxFromPotential(QRectF potDraw)
 {
     prepareGeometryChange();
     drawBox = potDraw;
+    rectsValid = false;
+    dropSubtreePixmap();
+    reindex();
 }
 
 /////////////
@@ -831,7 +1629,7 @@ void Node::setDrawBoxFromPotential(QRectF potDraw)
 
 void Node::mousePressEvent(QGraphicsSceneMouseEvent* event)
 {
-    qDebug() << "clicked on node " << myID << "sel is " << selected;
+    qCDebug(lcInput) << "clicked on node " << myID << "sel is " << selected;
 
     if (event->buttons() & Qt::LeftButton)
     {
@@ -839,21 +1637,22 @@ void Node::mousePressEvent(QGraphicsSceneMouseEvent* event)
         {
             ghost = true;
             raiseAllAncestors();
+            containInAncestors(false);
         }
         else if (event->modifiers() & Qt::ControlModifier) {
-            qDebug() << "copying";
+            qCDebug(lcInput) << "copying";
             canvas->clearSelection(); // TODO: make copying copy a selection
             copying = true;
             locked = true;
 
             newCopy = copyMeToParent();
             raiseAllAncestors();
+            containInAncestors(false);
         }
 
         mouseOffset = event->pos();
-        shadow->setEnabled(true);
         mouseDown = true;
-        update();
+        refreshPaintState();
     }
     else if (event->buttons() & Qt::RightButton)
     {
@@ -865,16 +1664,18 @@ void Node::mousePressEvent(QGraphicsSceneMouseEvent* event)
 
 void Node::mouseReleaseEvent(QGraphicsSceneMouseEvent* event)
 {
+    canvas->flushDrag();
+    canvas->endDrag();
     mouseDown = false;
-    shadow->setEnabled(false);
 
     if (ghost || copying) {
         copying = ghost = locked = false;
         lowerAllAncestors();
+        containInAncestors(true);
 
         if (newParent != nullptr && newParent->target) {
             newParent->target = false;
-            newParent->update();
+            newParent->refreshPaintState();
         }
 
         if (newParent != parent) {
@@ -894,7 +1695,7 @@ void Node::mouseReleaseEvent(QGraphicsSceneMouseEvent* event)
             newParent->updateAncestors();
         }
         else {
-            qDebug() << "Moved around in same parent";
+            qCDebug(lcInput) << "Moved around in same parent";
             parent->updateAncestors();
         }
 
@@ -904,7 +1705,7 @@ void Node::mouseReleaseEvent(QGraphicsSceneMouseEvent* event)
         newCopy = nullptr;
     }
 
-    update();
+    refreshPaintState();
     QGraphicsObject::mouseReleaseEvent(event);
 }
 
@@ -921,10 +1722,22 @@ void Node::hoverLeaveEvent(QGraphicsSceneHoverEvent* event)
 }
 
 /*
- * Dragging the mouse around will initiate the collision testing. If it finds a
- * valid target, it will visually move the node there.
+ * Mouse moves only record where the drag has got to; the canvas calls dragTo
+ * with the latest position at most once per frame
  */
 void Node::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
+{
+    if (mouseDown)
+        canvas->queueDrag(this, event->scenePos());
+}
+
+/*
+ * One step of a drag, with the mouse at mouseScenePos. This is where the
+ * collision testing happens: if it finds a valid target, this node (and the
+ * rest of the selection) visually moves there, otherwise as far towards it as
+ * collisions allow.
+ */
+void Node::dragTo(QPointF mouseScenePos)
 {
     if (mouseDown)
     {
@@ -932,12 +1745,13 @@ void Node::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
         // calculations against the upper left corner
         qreal dx = mouseOffset.x();
         qreal dy = mouseOffset.y();
+        QPointF local = mapFromScene(mouseScenePos);
 
         // Work on this as a selected item
         QList<Node*> sel = canvas->selectionIncluding(this);
         QList<QPointF> scenePts;
 
-        QPointF adj = QPointF(event->pos().x() - dx, event->pos().y() - dy);
+        QPointF adj = QPointF(local.x() - dx, local.y() - dy);
         scenePts.append(mapToScene(adj));
 
         for (Node* n : sel)
@@ -960,40 +1774,43 @@ void Node::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
         canvas->clearBounds();
 
         // Moved a lil bit at least, so lets check it
-        for (QPointF pt : bloom)
+        if (ghost || copying)
         {
-            // Check
-            if (ghost || copying)
-            {
-                if (newParent != nullptr && newParent->target) {
-                    newParent->target = false;
-                    newParent->update();
-                }
-
-                Node* collider = determineNewParent(event->scenePos());
-                newParent = collider;
+            // Ghosts pass over everything, so they just take the snapped point
+            QPointF pt = bloom.first();
 
-                if (newParent != nullptr && !newParent->target && !newParent->isRoot()) {
-                    newParent->target = true;
-                    newParent->update();
-                }
+            if (newParent != nullptr && newParent->target) {
+                newParent->target = false;
+                newParent->refreshPaintState();
+            }
 
+            Node* collider = determineNewParent(mouseScenePos);
+            newParent = collider;
 
-                //canvas->addBlueBound(collider->getSceneDraw());
-                for (Node* n : sel)
-                    n->moveBy(pt.x(), pt.y());
-                if (sel.size() == 1)
-                    canvas->clearSelection();
-                return;
-            }
-            if (checkPotential(sel, pt))
-            {
-                for (Node* n : sel)
-                    n->moveBy(pt.x(), pt.y());
-                if (sel.size() == 1)
-                    canvas->clearSelection();
-                return;
+            if (newParent != nullptr && !newParent->target && !newParent->isRoot()) {
+                newParent->target = true;
+                newParent->refreshPaintState();
             }
+
+
+            //canvas->addBlueBound(collider->getSceneDraw());
+            for (Node* n : sel)
+                n->moveBy(pt.x(), pt.y());
+            if (sel.size() == 1)
+                canvas->clearSelection();
+            return;
+        }
+
+        // Check every bloom point in one go
+        int found = firstValidDelta(sel, bloom);
+        if (found >= 0)
+        {
+            QPointF pt = bloom.at(found);
+            for (Node* n : sel)
+                n->moveBy(pt.x(), pt.y());
+            if (sel.size() == 1)
+                canvas->clearSelection();
+            return;
         }
 
         // not sure if i like this, but it's needed for now (lazy coding made
@@ -1010,21 +1827,27 @@ void Node::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
 
 Node* Node::determineNewParent(QPointF pt)
 {
-    Node* root = canvas->getRoot();
-    QList<Node*> pot = root->children;
+    Node* collider = canvas->getRoot();
 
-    Node* collider = root;
+    // Top level cuts without views can still take the drop
+    canvas->hydrateRecordsIn(QRectF(pt.x() - 0.5, pt.y() - 0.5, 1, 1));
 
-    // TODO: rewrite this to avoid goto
-loop:
-    for (Node* n : pot) {
-        if (n == this || n->locked || n->isStatement())
-            continue;
+    // Keep descending as long as one of the nearby children contains pt
+    bool descended = true;
+    while (descended)
+    {
+        descended = false;
+        QPointF local = pt - collider->getSceneOrigin();
 
-        if (pointInRect(pt, n->getSceneDraw())) {
-            collider = n;
-            pot = collider->children;
-            goto loop; // repeat loop with the new potential list
+        for (Node* n : collider->childIndex.query(QRectF(local, local))) {
+            if (n == this || n->locked || n->isStatement())
+                continue;
+
+            if (pointInRect(pt, n->getSceneDraw())) {
+                collider = n;
+                descended = true;
+                break;
+            }
         }
     }
 
@@ -1051,16 +1874,34 @@ void Node::lowerAllAncestors()
     }
 }
 
+/*
+ * Ghost and copy drags take me outside my ancestors' walls without growing
+ * them, which breaks the promise ItemContainsChildrenInShape makes to Qt (it
+ * would stop painting and hit testing me once an ancestor is off screen). So
+ * the ancestors drop the flag for the length of the drag.
+ */
+void Node::containInAncestors(bool contain)
+{
+    if (canvas->getIndexMode() != Canvas::NestedIndexMode)
+        return;
+
+    for (Node* curr = parent; curr != nullptr && !curr->isRoot(); curr = curr->parent)
+        curr->setFlag(ItemContainsChildrenInShape, contain);
+}
+
 void Node::adoptChild(Node* n) {
     Node* oldParent = n->getParent();
     if (oldParent != nullptr) {
         // Remove the old connection
         oldParent->children.removeOne(n);
+        oldParent->unindexChild(n);
         oldParent->updateAncestors();
     }
     n->parent = this;
     n->setParentItem(this);
     children.append(n);
+    canvas->getModel().reparent(n->modelId, modelId);
+    indexChild(n);
 }
 
 ///////////////
@@ -1131,14 +1972,15 @@ bool rectsCollide(const QRectF &a, const QRectF &b)
 }
 
 /*
- * Debug function to print out (to qDebug) some text and a point's (x,y) coords
+ * Debug function to print out (to the layout log) some text and a point's (x,y)
+ * coords
  */
 void printPt(const QString &s, const QPointF &pt)
 {
-    qDebug() << s
-             << pt.x()
-             << ","
-             << pt.y();
+    qCDebug(lcLayout) << s
+                      << pt.x()
+                      << ","
+                      << pt.y();
 }
 
 
@@ -1147,14 +1989,14 @@ void printPt(const QString &s, const QPointF &pt)
  */
 void printRect(const QString &s, const QRectF &r)
 {
-    qDebug() << s
-             << r.topLeft().x()
-             << ","
-             << r.topLeft().y()
-             << ":"
-             << r.bottomRight().x()
-             << ","
-             << r.bottomRight().y();
+    qCDebug(lcLayout) << s
+                      << r.topLeft().x()
+                      << ","
+                      << r.topLeft().y()
+                      << ":"
+                      << r.bottomRight().x()
+                      << ","
+                      << r.bottomRight().y();
 }
 
 /*
@@ -1162,15 +2004,15 @@ void printRect(const QString &s, const QRectF &r)
  */
 void printMinMax(qreal minX, qreal minY, qreal maxX, qreal maxY)
 {
-    qDebug() << "min: ("
-             << minX
-             << ","
-             << minY
-             << ") | max: ("
-             << maxX
-             << ","
-             << maxY
-             << ")";
+    qCDebug(lcLayout) << "min: ("
+                      << minX
+                      << ","
+                      << minY
+                      << ") | max: ("
+                      << maxX
+                      << ","
+                      << maxY
+                      << ")";
 }
 
 
@@ -1233,247 +2075,158 @@ bool pointInRect(const QPointF &pt, const QRectF &rect)
 }
 
 /*
- * A second bloom. More naive (no distance checking or sorting), but adds a few
- * more points. Additionally, the returned QList will always be size 9, never
- * empty like the other bloom may return if no movement.
- *
- * scenePos is unsnapped and in scene coords, and is the top left point of a
- * newly added drawbox.
- *
- * The points in this bloom are ordered as follows:
- *
- *     1 2 4
- *     3 0 6     where 0 is the initial snapped point
- *     5 7 8     and other points are placed GRID_SPACING apart
- *
- *   9  10 12 14 16
- *   11 1  2  4  18
- *   13 3  0  6  20
- *   15 5  7  8  22
- *   17 19 21 23 24
- *
- *  // Added one more upper left just in case
- *   25 26 28 30 32 34
- *   27 9  10 12 14 16
- *   29 11 1  2  4  18
- *   31 13 3  0  6  20
- *   33 15 5  7  8  22
- *   35 17 19 21 23 24
- *
- * TODO: rework things so we can use just one bloom, since they're basically
- * identical anyway.
- *
- * TODO: come up with a smarter spiraling out algorithm so everything is cleaner
- * and not hardcoded
+ * What it would cost my ancestors if a node with box potDraw (in scene
+ * coords) became one of my children. Follows the growth all the way up: if I
+ * have to grow to fit it, my parent may have to grow to fit me, and so on,
+ * stopping at the first ancestor that already has room. At each level that
+ * grows, the new walls are checked against that node's siblings (which
+ * nothing else would catch until the user moves things), and the extra area
+ * is added up. Only cached scene boxes and the sibling indexes are used,
+ * though growth at the top level hydrates the records it reaches (which is
+ * why this isn't const).
  */
-QList<QPointF> constructAddBloom(const QPointF &scenePos)
+Node::GrowthCost Node::growthCost(const QRectF &potDraw)
 {
-    QPointF snapped = snapPoint(scenePos);
-    QList<QPointF> bloom;
+    GrowthCost cost = { 0, 0 };
+    QRectF inner = potDraw;
 
-    bloom.append(snapped);
-    bloom.append(QPointF(snapped.x() - qreal(GRID_SPACING), snapped.y() - qreal(GRID_SPACING)));
-    bloom.append(QPointF(snapped.x(),  snapped.y() - qreal(GRID_SPACING)));
+    for (Node* n = this; !n->isRoot(); n = n->parent)
+    {
+        QRectF wall = n->getSceneDraw();
+        QRectF need = inner.adjusted(-qreal(GRID_SPACING), -qreal(GRID_SPACING),
+                                     qreal(GRID_SPACING), qreal(GRID_SPACING))
+                           .united(wall);
+        if (need == wall)
+            break;
 
-    bloom.append(QPointF(snapped.x() - qreal(GRID_SPACING), snapped.y()));
-    bloom.append(QPointF(snapped.x() + qreal(GRID_SPACING), snapped.y() - qreal(GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(GRID_SPACING), snapped.y() + qreal(GRID_SPACING)));
+        cost.area += need.width() * need.height() - wall.width() * wall.height();
 
-    bloom.append(QPointF(snapped.x() + qreal(GRID_SPACING), snapped.y()));
-    bloom.append(QPointF(snapped.x(),  snapped.y() + qreal(GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(GRID_SPACING), snapped.y() + qreal(GRID_SPACING)));
-
-    // New 16 (starts at 9)
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(1 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() - qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(0 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-
-    // 13
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() - qreal(0 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(1 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() + qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-
-    // 17
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() - qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(1 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() - qreal(0 * GRID_SPACING)));
-
-    // 21
-    bloom.append(QPointF(snapped.x() - qreal(0 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() + qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(1 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-
-    // 25
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(2 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() - qreal(2 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(1 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() - qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(0 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() - qreal(0 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(1 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() + qreal(1 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() + qreal(2 * GRID_SPACING), snapped.y() - qreal(3 * GRID_SPACING)));
-    bloom.append(QPointF(snapped.x() - qreal(3 * GRID_SPACING), snapped.y() + qreal(2 * GRID_SPACING)));
-
-
-    return bloom;
+        QRectF needColl = n->toCollision(need);
+        QPointF parentOrigin = n->parent->getSceneOrigin();
+        if (n->parent->isRoot())
+            canvas->hydrateRecordsIn(needColl);
+        for (Node* sib : n->parent->childIndex.hits(needColl.translated(-parentOrigin)))
+        {
+            if (sib != n)
+                ++cost.collisions;
+        }
+
+        inner = need;
+    }
+
+    return cost;
 }
 
 /*
- * Tries to find a valid point for the add function. Bloom should be non-empty.
- *
- * If no valid point found, returns the first point in the bloom (which should
- * be the snapped mousePos in scene coords if the bloom was created
- * successfully).
- *
- * Otherwise, this function returns a valid topLeft position in scene coords
- * such that a node of size w by h would have:
+ * Tries to find a point for the add function. Returns a topLeft position in
+ * scene coords, searched for in a square spiral over the grid around the
+ * snapped pt, such that a node of size w by h would have:
  *   1. no collisions with direct siblings
  *   2. no growing of the parent
  *
- * TODO: extend to percolate upwards, just in case we have multiple points that
- * avoid collision with siblings, and potentially one (or more or none) would
- * cause a collision when the parent, grandparent, etc. grew.
+ * The first point satisfying both is returned. Rings further out than my own
+ * walls can only grow me, so once one is reached the search settles for the
+ * collision-free point with the cheapest growthCost: fewest collisions caused
+ * further up, then the least area grown across all ancestors. Since the space
+ * outside my children is always free, the search always finds somewhere to
+ * go.
+ *
+ * Ring r is visited clockwise from its top left corner, e.g. for r = 1:
+ *
+ *     1 2 3
+ *     8 0 4     where 0 is the snapped point
+ *     7 6 5     and other points are placed GRID_SPACING apart
  *
  * NOTE: this function is called on/by the parent of a new node. So the new
  * node's width and height are the params, and (this) is the parent of such a
  * node.
  */
-QPointF Node::findPoint(const QList<QPointF> &bloom, qreal w, qreal h, bool isStatement)
+QPointF Node::findPoint(QPointF pt, qreal w, qreal h)
 {
-    Q_UNUSED(isStatement)
-
-    QList<QPointF> collOnly; // parallel
-    QList<qreal> growSizes;  // to this -- size of the grown parent (heuristic)
-
-    QList<QPointF> growOnly;
-
     canvas->clearBounds();
 
-    //qDebug() << "--- Start for ---";
-    for (QPointF pt : bloom)
+    const QPointF snapped = snapPoint(pt);
+    const QPointF origin = getSceneOrigin();
+    const qreal g = qreal(GRID_SPACING);
+
+    // Past this ring, every candidate sticks out of my walls
+    int wallRing = 0;
+    if (!isRoot())
     {
-        bool collOkay = true;
-        bool growOkay = true; // TODO: actual checking logic
+        QRectF sceneDraw = getSceneDraw();
+        qreal reach = qMax(qMax(qAbs(sceneDraw.left() - snapped.x()),
+                                qAbs(sceneDraw.right() - snapped.x())),
+                           qMax(qAbs(sceneDraw.top() - snapped.y()),
+                                qAbs(sceneDraw.bottom() - snapped.y())));
+        wallRing = qCeil(reach / g);
+    }
+
+    bool haveBest = false;
+    QPointF best = snapped;
+    GrowthCost bestCost = { 0, 0 };
 
-        qreal growSize;
+    // Neighbouring candidates tend to hit the same sibling, so try the last
+    // one hit before going to the index
+    Node* lastHit = nullptr;
 
-        QPointF bottomRight(pt.x() + w, pt.y() + h);
-        QRectF potDraw = QRectF(pt, bottomRight);
-        QRectF potColl = toCollision(potDraw);
+    for (int r = 0; r <= SPIRAL_MAX_RINGS; ++r)
+    {
+        if (haveBest && r > wallRing)
+            break;
 
-        //qDebug() << "--- Checking point ---";
-        // Collision Check
-        for (Node* n : children)
+        int count = (r == 0) ? 1 : 8 * r;
+        for (int i = 0; i < count; ++i)
         {
-            // TODO: allow statements to be closer
-
-            //QRectF otherColl;
-            //QRectF newColl;
-            //if (n->isStatement() && isStatement)
-            //{
-                //otherColl = n->getSceneDraw();
-                //newColl = potDraw;
-            //}
-            //else
-            //{
-                //otherColl = n->getSceneCollisionBox();
-                //newColl = potColl;
-            //}
-
-            if (rectsCollide(potColl, n->getSceneCollisionBox()))
+            // Walk the ring: top edge, right edge, bottom edge, left edge
+            int dx = 0, dy = 0;
+            if (r > 0)
             {
-                collOkay = false;
-                break;
+                int side = i / (2 * r), step = i % (2 * r);
+                switch (side)
+                {
+                case 0: dx = -r + step; dy = -r;        break;
+                case 1: dx = r;         dy = -r + step; break;
+                case 2: dx = r - step;  dy = r;         break;
+                default: dx = -r;       dy = r - step;  break;
+                }
             }
-        }
 
-        // TODO: growth check
-        if (!isRoot())
-        {
-            QRectF sceneDraw = getSceneDraw();
+            QPointF cand(snapped.x() + dx * g, snapped.y() + dy * g);
+            QRectF potDraw(cand, QSizeF(w, h));
+            QRectF potColl = toCollision(potDraw);
 
-            printPt("potDraw tl", potDraw.topLeft());
-            printPt("sceneDraw tl", sceneDraw.topLeft());
-            printPt("potDraw br", potDraw.bottomRight());
-            printPt("sceneDraw br", sceneDraw.bottomRight());
-
-            qreal minX = qMin(potDraw.left() - qreal(GRID_SPACING), sceneDraw.left());
-            qreal minY = qMin(potDraw.top() - qreal(GRID_SPACING), sceneDraw.top());
-            qreal maxX = qMax(potDraw.right() + qreal(GRID_SPACING), sceneDraw.right());
-            qreal maxY = qMax(potDraw.bottom() + qreal(GRID_SPACING), sceneDraw.bottom());
+            if (lastHit != nullptr && rectsCollide(potColl, lastHit->getSceneCollisionBox()))
+                continue;
 
-            if ( minX != sceneDraw.left() ||
-                 minY != sceneDraw.top() ||
-                 maxX != sceneDraw.right() ||
-                 maxY != sceneDraw.bottom() )
+            if (isRoot())
+                canvas->hydrateRecordsIn(potColl);
+            Node* hit = childIndex.firstHit(potColl.translated(-origin));
+            if (hit != nullptr)
             {
-                qDebug() << "Parent changed size";
-                growOkay = false;
-                growSize = (maxX - minX) * (maxY - minY);
-                //canvas->addRedBound(potDraw);
+                lastHit = hit;
+                continue;
             }
-            else
+
+            GrowthCost cost = growthCost(potDraw);
+            if (cost.isFree())
             {
-                qDebug() << "parent ok";
-                //canvas->addBlueBound(potDraw);
+                if (EGG_DEBUG_ENABLED(lcLayout))
+                    printPt("Returning", cand);
+                return cand;
             }
-        }
 
-        if (collOkay && growOkay)
-        {
-            printPt("Returning", pt);
-            return pt;
-        }
-        else if (collOkay)
-        {
-            // didn't collide with siblings, but the parent grew
-            collOnly.append(pt);
-            growSizes.append(growSize);
-        }
-        else if (growOkay)
-        {
-            // collided with siblings, but no parent growth
-            // TODO: i'm thinking this heuristic is not desirable
-            growOnly.append(pt);
-        }
-    }
-    //qDebug() << "--- end for ---";
-
-    if (!collOnly.empty())
-    {
-        qDebug() << "Coll only not empty";
-        //return collOnly.first();
-        // Heuristic: pick the item that makes the smallest area
-        QList<QPointF>::iterator itp = collOnly.begin();
-        QList<qreal>::iterator ita = growSizes.begin(); // these are parallel
-
-        QPointF ret = collOnly.first();
-        qreal min = growSizes.first();
-
-        for (; itp != collOnly.end(); ++itp, ++ita)
-        {
-            if ((*ita) < min)
+            if (!haveBest || cost < bestCost)
             {
-                ret = (*itp);
-                min = (*ita);
+                haveBest = true;
+                best = cand;
+                bestCost = cost;
             }
         }
-
-        return ret;
     }
-    if (!growOnly.empty())
-    {
-        qDebug() << "Grow only not empty";
-        // TODO: get rid of this heuristic (don't think its useful)
-    }
-    // Nothing worked, so return snapped
-    return bloom.first();
+
+    qCDebug(lcLayout) << "no room without growing, best cost"
+                      << bestCost.collisions << bestCost.area;
+    return best;
 }
 
 // Assumed that they collide & share the same coord system
@@ -3,28 +3,38 @@
 
 #include <QGraphicsObject>
 #include <QRadialGradient>
-#include <QGraphicsDropShadowEffect>
 
-class Canvas;
+#include "colorpalette.h"
+#include "graphmodel.h"
+#include "spatialindex.h"
+#include "symboltable.h"
 
-enum NodeType
-{
-    Root,
-    Cut,
-    Statement,
-    Placeholder
-};
+class Canvas;
 
 class Node : public QGraphicsObject
 {
+    friend class Bench; // bench/bench.h
+    friend class Document; // document.h
+    friend class Layout; // layout.h
+
 public:
     static Node* makeRoot(Canvas* can);
     ~Node();
 
+    // Nodes live in their canvas's pool (see nodepool.h)
+    static void* operator new(size_t size, Canvas* can);
+    static void operator delete(void* p);
+    static void operator delete(void* p, Canvas* can);
+
     // Add
     Node* addChildCut(QPointF pt, bool usePrediction = true);
     Node* addChildStatement(QPointF pt, QString t, bool usePrediction = true);
     Node* addChildPlaceholder(QPointF pt);
+    Node* hydrateChild(int id);
+
+    // Delete
+    void deleteChildren();
+    void releaseView();
 
     // Highlight
     void setAsHighlight();
@@ -42,6 +52,12 @@ public:
     Node* getRightSibling();
     Node* getLeftSibling();
     Node* getChild();
+    int getSymbol() const { return symbol; }
+    QString getLetter() const
+    {
+        return symbol == SymbolTable::NoSymbol ?
+                    QString() : SymbolTable::instance().text(symbol);
+    }
 
     // Selection
     void toggleSelection();
@@ -53,13 +69,25 @@ public:
 
     static void setSelectionFromBox(Node* root, QRectF selBox);
 
+    // Lookup
+    static Node* nodeAt(Node* root, QPointF pt);
+    void useNestedLookup(bool nested);
+
+    // Level of detail
+    void refreshLevelOfDetail(qreal lod, bool insideCollapsed = false);
+
     void adoptChild(Node* n);
     void updateAncestors();
+    bool relayout();
+    int getDepth() const;
 
     int getID() { return myID; }
+    int getModelId() const { return modelId; }
 
     QRectF getSceneDraw(qreal deltaX = 0, qreal deltaY = 0) const;
 
+    void dragTo(QPointF mouseScenePos);
+
 private:
 
     //////////////
@@ -71,10 +99,10 @@ private:
 
     Canvas* canvas;
     Node* parent;
+    int modelId; // my record in the canvas's GraphModel
 
     // Visual details
     NodeType type;
-    QString text;
 
     QRectF drawBox;
 
@@ -91,17 +119,23 @@ private:
     //QRadialGradient gradClicked;
     //QRadialGradient gradSelected;
 
-    QGraphicsDropShadowEffect* shadow;
-
     // Important points
     QPointF mouseOffset;
 
     // Children
     QList<Node*> children;
+    SpatialIndex childIndex; // collision boxes of children, in my coords
+    QRectF indexedRect;      // my collision box as stored in parent's index
 
     // Statement specific details
-    QString letter;
-    QFont font;
+    int symbol; // id in SymbolTable, NoSymbol for cuts and the root
+
+    // Set while my subtree is being deleted, so my children don't bother
+    // unhooking themselves from me one at a time
+    bool tearingDown;
+
+    // Set when only my view is going away and my model records stay
+    bool keepRecord;
 
     // Selection
     bool selected, parentSelected;
@@ -111,21 +145,70 @@ private:
     Node* determineNewParent(QPointF pt);
     void raiseAllAncestors();
     void lowerAllAncestors();
+    void containInAncestors(bool contain);
 
     Node* newParent;
     Node* newCopy;
     bool target;
 
+    // Paint state, derived from the flags above by refreshPaintState()
+    ColorPalette::Fill fill;
+    void refreshPaintState();
+
+    // Level of detail: a cut too small on screen paints its whole subtree
+    // from one cached pixmap, rendered at subtreeLod
+    bool subtreeCached;
+    qreal subtreeLod;
+    bool isCollapsedAt(qreal lod) const;
+    QString subtreeKey() const;
+    void paintCollapsed(QPainter* painter, qreal lod);
+    void paintSubtree(QPainter* painter, qreal lod) const;
+    void paintBody(QPainter* painter, qreal lod) const;
+    void dropSubtreePixmap();
+
+    // Cached scene geometry: the scene position of my local origin, plus my
+    // drawBox and collision box mapped to the scene. Nodes are never rotated
+    // or scaled, so mapping to the scene is only ever a translation.
+    mutable QPointF cachedOrigin;
+    mutable QRectF cachedSceneDraw;
+    mutable QRectF cachedSceneColl;
+    mutable bool originValid;
+    mutable bool rectsValid;
+
+    // Running union of my children's drawBoxes (in my coords). Only rescanned
+    // after a child on the boundary moves inwards or is removed.
+    mutable QRectF childExtents;
+    mutable bool extentsValid;
+
     // Add
-    QPointF findPoint(const QList<QPointF> &bloom, qreal w, qreal h, bool isStatement = false);
+    QPointF findPoint(QPointF pt, qreal w, qreal h);
+
+    // What placing a new child costs the ancestors: how many of their
+    // siblings the grown walls would run into, then how much area they grow
+    struct GrowthCost
+    {
+        int collisions;
+        qreal area;
+
+        bool isFree() const { return collisions == 0 && area == 0; }
+        bool operator<(const GrowthCost &o) const
+        {
+            return collisions < o.collisions ||
+                   (collisions == o.collisions && area < o.area);
+        }
+    };
+    GrowthCost growthCost(const QRectF &potDraw);
 
     ///////////////
     /// Methods ///
     ///////////////
 
     // Private constructor
-    Node(Canvas* can, Node* par, NodeType t, QPointF pt);
-    Node(Canvas* can, Node* par, QString s, QPointF pt);
+    Node(Canvas* can, Node* par, NodeType t, QPointF pt,
+         int record = GraphModel::NoId);
+    Node(Canvas* can, Node* par, QString s, QPointF pt,
+         int record = GraphModel::NoId);
+    void attachToModel(int record);
 
 
     // Graphics
@@ -140,9 +223,24 @@ private:
     QRectF toCollision(QRectF draw) const;
     QRectF toDraw(QRectF collision) const;
     QRectF getSceneCollisionBox(qreal deltaX = 0, qreal deltaY = 0) const;
+    QPointF getSceneOrigin() const;
+    void updateSceneCache() const;
+    void invalidateSceneGeometry();
+
+    // Sibling index
+    void indexChild(Node* n);
+    void unindexChild(Node* n);
+    void reindex();
+    void syncModel();
+    QRectF getParentDraw() const;
+    QRectF getChildExtents() const;
+    bool onExtentsBoundary(const QRectF &r) const;
+    QVariant itemChange(GraphicsItemChange change,
+                        const QVariant &value) override;
 
     // Collision Checking
     static bool checkPotential(QList<Node*> sel, QPointF pt);
+    static int firstValidDelta(QList<Node*> sel, const QList<QPointF> &deltas);
     QRectF predictMySceneDraw(QList<Node*> altNodes, QList<QRectF> altDraws);
     void setDrawBoxFromPotential(QRectF potDraw);
 
@@ -0,0 +1,77 @@
+#include "nodepool.h"
+#include "constants.h"
+#include "logging.h"
+
+#include <new>
+
+NodePool::NodePool(size_t objectSize) :
+    slotSize(sizeof(Header) +
+             (objectSize + sizeof(Header) - 1) / sizeof(Header) * sizeof(Header)),
+    freeList(nullptr),
+    live(0)
+{
+
+}
+
+NodePool::~NodePool()
+{
+    if (live != 0)
+        qCWarning(lcEdit) << live << "nodes still alive when their pool went";
+
+    for (char* slab : slabs)
+        ::operator delete(slab);
+}
+
+/*
+ * Returns storage for one node of the given size (at most the size the pool
+ * was made for)
+ */
+void* NodePool::allocate(size_t size)
+{
+    Q_ASSERT(sizeof(Header) + size <= slotSize);
+
+    if (freeList == nullptr)
+        addSlab();
+
+    Header* h = freeList;
+    freeList = h->next;
+    h->owner = this;
+    ++live;
+
+    return h + 1;
+}
+
+/*
+ * (Static) Hands storage from allocate() back to the pool it came from
+ */
+void NodePool::release(void* p)
+{
+    if (p == nullptr)
+        return;
+
+    Header* h = static_cast<Header*>(p) - 1;
+    NodePool* pool = h->owner;
+
+    h->next = pool->freeList;
+    pool->freeList = h;
+    --pool->live;
+}
+
+/*
+ * Takes a fresh slab and threads its slots onto the free list, lowest address
+ * first so consecutive allocations stay next to each other
+ */
+void NodePool::addSlab()
+{
+    char* slab = static_cast<char*>(::operator new(slotSize * NODES_PER_SLAB));
+    slabs.append(slab);
+
+    for (int i = NODES_PER_SLAB - 1; i >= 0; --i)
+    {
+        Header* h = reinterpret_cast<Header*>(slab + slotSize * size_t(i));
+        h->next = freeList;
+        freeList = h;
+    }
+
+    qCDebug(lcEdit) << "Node pool grew to" << slabs.size() << "slabs";
+}
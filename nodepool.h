@@ -0,0 +1,54 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <QList>
+
+#include <cstddef>
+
+/*
+ * Slab storage for the nodes of one canvas.
+ *
+ * The Node objects themselves are carved out of slabs of NODES_PER_SLAB
+ * slots, so the Node shell costs one allocation per slab instead of one per
+ * node. Only the shell: every Node is a QGraphicsObject, and Qt still puts
+ * its QObject and QGraphicsItem private data on the heap for each node (as
+ * do the children list and sibling index). Freed slots go on a free list and
+ * are reused before a new slab is taken; slabs are only handed back when the
+ * pool itself goes (with its canvas).
+ *
+ * Every slot starts with a small header naming its pool, which is how
+ * Node::operator delete finds where to return the slot.
+ */
+class NodePool
+{
+public:
+    explicit NodePool(size_t objectSize);
+    ~NodePool();
+
+    void* allocate(size_t size);
+    static void release(void* p);
+
+    int liveCount() const { return live; }
+    int slabCount() const { return slabs.size(); }
+
+private:
+    // Kept at max_align_t so the object after it is suitably aligned
+    union Header
+    {
+        NodePool* owner; // while the slot is in use
+        Header* next;    // while it's on the free list
+        std::max_align_t align;
+    };
+
+    size_t slotSize;
+    QList<char*> slabs;
+    Header* freeList;
+    int live;
+
+    void addSlab();
+
+    NodePool(const NodePool &) = delete;
+    NodePool &operator=(const NodePool &) = delete;
+};
+
+#endif // NODEPOOL_H
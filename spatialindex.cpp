@@ -0,0 +1,353 @@
+#include "spatialindex.h"
+#include "constants.h"
+
+#include <QtCore/QtMath>
+#include <QSet>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EGG_SSE2
+#endif
+
+/////////////
+/// Cells ///
+/////////////
+
+void SpatialIndex::Cell::append(Node* n, const QRectF &r)
+{
+    nodes.append(n);
+    x1.append(float(r.left()));
+    y1.append(float(r.top()));
+    x2.append(float(r.right()));
+    y2.append(float(r.bottom()));
+}
+
+bool SpatialIndex::Cell::removeOne(Node* n)
+{
+    int i = nodes.indexOf(n);
+    if (i < 0)
+        return false;
+
+    nodes.remove(i);
+    x1.remove(i);
+    y1.remove(i);
+    x2.remove(i);
+    y2.remove(i);
+    return true;
+}
+
+/*
+ * Calls hit(i) for each box i in the cell that overlaps r, in order, until
+ * hit returns false. Four boxes are tested per step with SSE2; the tail (and
+ * everything, without SSE2) falls back to the scalar test.
+ */
+template <typename Cell, typename Hit>
+static void forEachOverlap(const Cell &c, const QRectF &r, Hit hit)
+{
+    const float qx1 = float(r.left());
+    const float qy1 = float(r.top());
+    const float qx2 = float(r.right());
+    const float qy2 = float(r.bottom());
+
+    const float* x1 = c.x1.constData();
+    const float* y1 = c.y1.constData();
+    const float* x2 = c.x2.constData();
+    const float* y2 = c.y2.constData();
+    const int count = c.nodes.size();
+    int i = 0;
+
+#ifdef EGG_SSE2
+    const __m128 vx1 = _mm_set1_ps(qx1);
+    const __m128 vy1 = _mm_set1_ps(qy1);
+    const __m128 vx2 = _mm_set1_ps(qx2);
+    const __m128 vy2 = _mm_set1_ps(qy2);
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 mx = _mm_and_ps(_mm_cmplt_ps(vx1, _mm_loadu_ps(x2 + i)),
+                               _mm_cmpgt_ps(vx2, _mm_loadu_ps(x1 + i)));
+        __m128 my = _mm_and_ps(_mm_cmplt_ps(vy1, _mm_loadu_ps(y2 + i)),
+                               _mm_cmpgt_ps(vy2, _mm_loadu_ps(y1 + i)));
+        int mask = _mm_movemask_ps(_mm_and_ps(mx, my));
+
+        for (int k = 0; mask != 0; ++k, mask >>= 1)
+        {
+            if ((mask & 1) && !hit(i + k))
+                return;
+        }
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+        if (qx1 < x2[i] && qx2 > x1[i] && qy1 < y2[i] && qy2 > y1[i])
+        {
+            if (!hit(i))
+                return;
+        }
+    }
+}
+
+/////////////
+/// Index ///
+/////////////
+
+/*
+ * Adds n to every cell touched by rect
+ */
+void SpatialIndex::insert(Node* n, const QRectF &rect)
+{
+    int x1, y1, x2, y2;
+    cellRange(rect, x1, y1, x2, y2);
+
+    for (int cx = x1; cx <= x2; ++cx)
+        for (int cy = y1; cy <= y2; ++cy)
+            cells[key(cx, cy)].append(n, rect);
+}
+
+/*
+ * Removes n from every cell touched by rect. The rect should be the same one
+ * that n was last inserted (or moved) with.
+ */
+void SpatialIndex::remove(Node* n, const QRectF &rect)
+{
+    int x1, y1, x2, y2;
+    cellRange(rect, x1, y1, x2, y2);
+
+    for (int cx = x1; cx <= x2; ++cx)
+    {
+        for (int cy = y1; cy <= y2; ++cy)
+        {
+            QHash<quint64, Cell>::iterator it = cells.find(key(cx, cy));
+            if (it == cells.end())
+                continue;
+
+            it->removeOne(n);
+            if (it->nodes.empty())
+                cells.erase(it);
+        }
+    }
+}
+
+/*
+ * Updates the cells of n after its rect changed. Most moves (a single grid
+ * step while dragging, a parent growing slightly) stay within the same cells,
+ * in which case only the stored rect needs updating.
+ */
+void SpatialIndex::move(Node* n, const QRectF &oldRect, const QRectF &newRect)
+{
+    int ox1, oy1, ox2, oy2;
+    int nx1, ny1, nx2, ny2;
+    cellRange(oldRect, ox1, oy1, ox2, oy2);
+    cellRange(newRect, nx1, ny1, nx2, ny2);
+
+    if (ox1 == nx1 && oy1 == ny1 && ox2 == nx2 && oy2 == ny2)
+    {
+        for (int cx = nx1; cx <= nx2; ++cx)
+        {
+            for (int cy = ny1; cy <= ny2; ++cy)
+            {
+                QHash<quint64, Cell>::iterator it = cells.find(key(cx, cy));
+                if (it == cells.end())
+                    continue;
+
+                int i = it->nodes.indexOf(n);
+                if (i < 0)
+                    continue;
+
+                it->x1[i] = float(newRect.left());
+                it->y1[i] = float(newRect.top());
+                it->x2[i] = float(newRect.right());
+                it->y2[i] = float(newRect.bottom());
+            }
+        }
+        return;
+    }
+
+    remove(n, oldRect);
+    insert(n, newRect);
+}
+
+/*
+ * Returns every node whose cells overlap rect (each node at most once). This
+ * is a superset of the actual collisions: callers still need to do the exact
+ * rect test on the results.
+ */
+QList<Node*> SpatialIndex::query(const QRectF &rect) const
+{
+    int x1, y1, x2, y2;
+    cellRange(rect, x1, y1, x2, y2);
+
+    // Common case: a single cell, so no duplicates are possible
+    if (x1 == x2 && y1 == y2)
+    {
+        QHash<quint64, Cell>::const_iterator it = cells.constFind(key(x1, y1));
+        if (it == cells.constEnd())
+            return QList<Node*>();
+        return it->nodes.toList();
+    }
+
+    QList<Node*> found;
+    QSet<Node*> seen;
+
+    // Huge query rects (a big cut checked against its siblings) would touch
+    // more empty cells than there are occupied ones, so walk the occupied
+    // cells instead in that case
+    qint64 span = qint64(x2 - x1 + 1) * qint64(y2 - y1 + 1);
+    if (span > cells.size())
+    {
+        QHash<quint64, Cell>::const_iterator it = cells.constBegin();
+        for (; it != cells.constEnd(); ++it)
+        {
+            int cx = int(quint32(it.key() >> 32));
+            int cy = int(quint32(it.key()));
+            if (cx < x1 || cx > x2 || cy < y1 || cy > y2)
+                continue;
+
+            for (Node* n : it->nodes)
+            {
+                if (seen.contains(n))
+                    continue;
+                seen.insert(n);
+                found.append(n);
+            }
+        }
+        return found;
+    }
+
+    for (int cx = x1; cx <= x2; ++cx)
+    {
+        for (int cy = y1; cy <= y2; ++cy)
+        {
+            QHash<quint64, Cell>::const_iterator it = cells.constFind(key(cx, cy));
+            if (it == cells.constEnd())
+                continue;
+
+            for (Node* n : it->nodes)
+            {
+                if (seen.contains(n))
+                    continue;
+                seen.insert(n);
+                found.append(n);
+            }
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Returns the first node (other than ignore) whose stored rect actually
+ * overlaps rect, or nullptr if there is none
+ */
+Node* SpatialIndex::firstHit(const QRectF &rect, const Node* ignore) const
+{
+    int x1, y1, x2, y2;
+    cellRange(rect, x1, y1, x2, y2);
+
+    Node* found = nullptr;
+    auto take = [&](const Cell &c) {
+        forEachOverlap(c, rect, [&](int i) {
+            if (c.nodes.at(i) == ignore)
+                return true;
+            found = c.nodes.at(i);
+            return false;
+        });
+    };
+
+    qint64 span = qint64(x2 - x1 + 1) * qint64(y2 - y1 + 1);
+    if (span > cells.size())
+    {
+        for (const Cell &c : cells)
+        {
+            take(c);
+            if (found != nullptr)
+                return found;
+        }
+        return nullptr;
+    }
+
+    for (int cx = x1; cx <= x2; ++cx)
+    {
+        for (int cy = y1; cy <= y2; ++cy)
+        {
+            QHash<quint64, Cell>::const_iterator it = cells.constFind(key(cx, cy));
+            if (it == cells.constEnd())
+                continue;
+
+            take(*it);
+            if (found != nullptr)
+                return found;
+        }
+    }
+
+    return nullptr;
+}
+
+/*
+ * Returns every node whose stored rect actually overlaps rect (each node at
+ * most once). Unlike query(), no further rect test is needed on the results.
+ */
+QList<Node*> SpatialIndex::hits(const QRectF &rect) const
+{
+    int x1, y1, x2, y2;
+    cellRange(rect, x1, y1, x2, y2);
+
+    QList<Node*> found;
+    QSet<Node*> seen;
+    bool single = (x1 == x2 && y1 == y2);
+
+    auto take = [&](const Cell &c) {
+        forEachOverlap(c, rect, [&](int i) {
+            Node* n = c.nodes.at(i);
+            if (single || !seen.contains(n))
+            {
+                if (!single)
+                    seen.insert(n);
+                found.append(n);
+            }
+            return true;
+        });
+    };
+
+    qint64 span = qint64(x2 - x1 + 1) * qint64(y2 - y1 + 1);
+    if (span > cells.size())
+    {
+        // Every overlapping box is in some cell inside the range, so there's
+        // no need to check the cell keys here
+        for (const Cell &c : cells)
+            take(c);
+        return found;
+    }
+
+    for (int cx = x1; cx <= x2; ++cx)
+    {
+        for (int cy = y1; cy <= y2; ++cy)
+        {
+            QHash<quint64, Cell>::const_iterator it = cells.constFind(key(cx, cy));
+            if (it != cells.constEnd())
+                take(*it);
+        }
+    }
+
+    return found;
+}
+
+/*
+ * Packs a pair of cell coordinates into a single hash key
+ */
+quint64 SpatialIndex::key(int cx, int cy)
+{
+    return (quint64(quint32(cx)) << 32) | quint64(quint32(cy));
+}
+
+/*
+ * Finds the (inclusive) range of cells touched by r
+ */
+void SpatialIndex::cellRange(const QRectF &r, int &x1, int &y1, int &x2, int &y2)
+{
+    x1 = qFloor(r.left() / qreal(INDEX_CELL_SIZE));
+    y1 = qFloor(r.top() / qreal(INDEX_CELL_SIZE));
+    x2 = qFloor(r.right() / qreal(INDEX_CELL_SIZE));
+    y2 = qFloor(r.bottom() / qreal(INDEX_CELL_SIZE));
+}
@@ -0,0 +1,53 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QVector>
+
+class Node;
+
+/*
+ * A uniform grid over the children of a single node, used to narrow sibling
+ * collision checks down to the handful of nodes that are actually nearby.
+ *
+ * Rects are stored in the coordinate system of the node that owns the index
+ * (i.e. the parent of everything inside it), so moving the parent around does
+ * not require any re-indexing. Each cell is INDEX_CELL_SIZE units square.
+ *
+ * Each cell also keeps its nodes' rects as separate coordinate arrays, so the
+ * exact overlap tests in firstHit() and hits() can check one rect against a
+ * whole cell four boxes at a time (SSE2 where available, scalar otherwise).
+ * Overlap uses the same open-interval test as rectsCollide, in float.
+ */
+class SpatialIndex
+{
+public:
+    void insert(Node* n, const QRectF &rect);
+    void remove(Node* n, const QRectF &rect);
+    void move(Node* n, const QRectF &oldRect, const QRectF &newRect);
+    void clear() { cells.clear(); }
+
+    QList<Node*> query(const QRectF &rect) const;
+    Node* firstHit(const QRectF &rect, const Node* ignore = nullptr) const;
+    QList<Node*> hits(const QRectF &rect) const;
+
+    // The grid itself, for anything else filed by the same cells
+    static quint64 key(int cx, int cy);
+    static void cellRange(const QRectF &r, int &x1, int &y1, int &x2, int &y2);
+
+private:
+    struct Cell
+    {
+        QVector<Node*> nodes;
+        QVector<float> x1, y1, x2, y2; // parallel to nodes
+
+        void append(Node* n, const QRectF &r);
+        bool removeOne(Node* n);
+    };
+
+    QHash<quint64, Cell> cells;
+};
+
+#endif // SPATIALINDEX_H
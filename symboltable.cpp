@@ -0,0 +1,56 @@
+#include "symboltable.h"
+#include "constants.h"
+
+#include <QTransform>
+
+SymbolTable::SymbolTable()
+{
+    // The labels Canvas hands out from the keyboard
+    for (char c = 'A'; c <= 'Z'; ++c)
+        intern(QString(QChar(c)));
+}
+
+/*
+ * (Static) The one table every canvas shares
+ */
+SymbolTable &SymbolTable::instance()
+{
+    static SymbolTable table;
+    return table;
+}
+
+/*
+ * Returns the id for s, adding it (and laying out its glyph) if it's new
+ */
+int SymbolTable::intern(const QString &s)
+{
+    QHash<QString, int>::const_iterator it = ids.constFind(s);
+    if (it != ids.constEnd())
+        return it.value();
+
+    QStaticText glyph(s);
+    glyph.setTextFormat(Qt::PlainText);
+    glyph.setPerformanceHint(QStaticText::AggressiveCaching);
+    glyph.prepare(QTransform(), font());
+
+    int id = texts.size();
+    ids.insert(s, id);
+    texts.append(s);
+    glyphs.append(glyph);
+    return id;
+}
+
+/*
+ * (Static) The font statements are drawn in
+ */
+const QFont &SymbolTable::font()
+{
+    static QFont statementFont;
+    static bool ready = false;
+    if (!ready)
+    {
+        statementFont.setPixelSize(GRID_SPACING * 2 - 6);
+        ready = true;
+    }
+    return statementFont;
+}
@@ -0,0 +1,46 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <QFont>
+#include <QHash>
+#include <QStaticText>
+#include <QString>
+#include <QVector>
+
+/*
+ * Every distinct statement label, numbered in the order first seen.
+ *
+ * Statements only store their label's id, so two statements match exactly
+ * when their ids do. The table keeps one copy of each label's text along
+ * with its glyph, laid out once in the shared statement font and reused by
+ * every statement that draws it.
+ *
+ * Ids are never retired, and the table is only touched from the GUI thread.
+ */
+class SymbolTable
+{
+public:
+    enum { NoSymbol = -1 };
+
+    static SymbolTable &instance();
+
+    int intern(const QString &s);
+
+    const QString &text(int id) const { return texts.at(id); }
+    const QStaticText &glyph(int id) const { return glyphs.at(id); }
+    int size() const { return texts.size(); }
+
+    static const QFont &font();
+
+private:
+    SymbolTable();
+
+    QHash<QString, int> ids;
+    QVector<QString> texts;
+    QVector<QStaticText> glyphs;
+
+    SymbolTable(const SymbolTable &) = delete;
+    SymbolTable &operator=(const SymbolTable &) = delete;
+};
+
+#endif // SYMBOLTABLE_H